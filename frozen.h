@@ -0,0 +1,273 @@
+// Minimal perfect hash over a fixed key set, in the style of PTHash and CHD, for tables that
+// are built once and then only read. Keys fall into buckets, every bucket gets a pilot that
+// sends its keys to slots no other key took, and count keys end up in exactly count slots.
+// Keys and values are copied into one block of strings next to the slots, and the whole
+// form can be written to a file and read back without hashing anything.
+
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Average keys per bucket of the perfect hash, more builds slower but keeps fewer pilots.
+#define FROZEN_BUCKET_KEYS 4
+// Pilots tried for one bucket before freezing starts over with another seed.
+#define MAX_PILOT (1u << 24)
+
+// Slot of a frozen table: the hash of its key and where key and value start in strings.
+// Misses are told apart by the hash without reading the key.
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;
+} FrozenEntry;
+
+// Read only form of a table built on a minimal perfect hash. A key hashes to one of
+// buckets buckets, whose pilot moves it to a slot of its own among count slots. strings
+// holds key and value of every slot back to back, each ending in a '\0'. A lookup is
+// one hash, one pilot, one slot and one key compare.
+typedef struct {
+    uint64_t seed;
+    uint64_t count;
+    uint64_t buckets;
+    uint64_t bytes;
+    uint32_t* pilot;
+    FrozenEntry* entry;
+    char* strings;
+} Frozen;
+
+// Seeded 64-bit hash for the frozen form, FNV-1a finished with the murmur3 mixer so
+// every bit of the result depends on every byte.
+static inline uint64_t seededHash(const char* key, uint64_t seed) {
+    uint64_t hash = seed ^ 0xcbf29ce484222325;
+    for (; *key; key++)
+        hash = (hash ^ (unsigned char)*key) * 0x100000001b3;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Maps x to [0, range) by its high bits, a multiply instead of a division.
+static inline uint64_t scaleDown(uint64_t x, uint64_t range) {
+    return (uint64_t)(((unsigned __int128)x * range) >> 64);
+}
+
+static inline uint64_t frozenBucket(Frozen* frozen, uint64_t hash) {
+    return scaleDown(hash, frozen->buckets);
+}
+
+// The multiply spreads every bit of hash and pilot into the high bits, which pick the slot
+// independently of the bucket.
+static inline uint64_t frozenSlot(Frozen* frozen, uint64_t hash, uint32_t pilot) {
+    return scaleDown((hash ^ (pilot * 0x9e3779b97f4a7c15)) * 0xff51afd7ed558ccd, frozen->count);
+}
+
+static inline const char* findFrozen(Frozen* frozen, const char* key) {
+    if (!frozen->count)
+        return NULL;
+    uint64_t hash = seededHash(key, frozen->seed);
+    FrozenEntry* entry = &frozen->entry[frozenSlot(frozen, hash, frozen->pilot[frozenBucket(frozen, hash)])];
+    if (entry->hash != hash)
+        return NULL;
+    const char* found = frozen->strings + entry->offset;
+    return strcmp(found, key) ? NULL : found + strlen(found) + 1;
+}
+
+static inline void freeFrozen(Frozen* frozen) {
+    free(frozen->pilot);
+    free(frozen->entry);
+    free(frozen->strings);
+    free(frozen);
+}
+
+// Finds a pilot for every bucket, largest buckets first while most slots are free, and
+// stores the slot of every key in slot. Returns 0 when two keys of a bucket share their
+// hash or a bucket runs out of pilots, the caller then tries another seed.
+static inline int placeKeys(Frozen* frozen, const uint64_t* hash, uint64_t* slot) {
+    size_t count = frozen->count, buckets = frozen->buckets;
+    // Counting sort of the keys by bucket, then of the buckets by size.
+    size_t* start = (size_t*)calloc(buckets + 1, sizeof(size_t));
+    size_t* keys = (size_t*)malloc(count * sizeof(size_t));
+    size_t maxSize = 0;
+    for (size_t i = 0; i < count; i++)
+        start[frozenBucket(frozen, hash[i]) + 1]++;
+    for (size_t b = 0; b < buckets; b++) {
+        if (start[b + 1] > maxSize)
+            maxSize = start[b + 1];
+        start[b + 1] += start[b];
+    }
+    size_t* fill = (size_t*)malloc(buckets * sizeof(size_t));
+    memcpy(fill, start, buckets * sizeof(size_t));
+    for (size_t i = 0; i < count; i++)
+        keys[fill[frozenBucket(frozen, hash[i])]++] = i;
+    size_t* bySize = (size_t*)calloc(maxSize + 2, sizeof(size_t));
+    for (size_t b = 0; b < buckets; b++)
+        bySize[maxSize - (start[b + 1] - start[b]) + 1]++;
+    for (size_t k = 0; k <= maxSize; k++)
+        bySize[k + 1] += bySize[k];
+    size_t* order = fill;
+    for (size_t b = 0; b < buckets; b++)
+        order[bySize[maxSize - (start[b + 1] - start[b])]++] = b;
+    free(bySize);
+
+    unsigned char* taken = (unsigned char*)calloc(count, 1);
+    int ok = 1;
+    for (size_t o = 0; o < buckets && ok; o++) {
+        size_t b = order[o], first = start[b], size = start[b + 1] - first;
+        if (!size) {
+            frozen->pilot[b] = 0;
+            continue;
+        }
+        for (size_t i = first + 1; i < first + size && ok; i++)
+            for (size_t j = first; j < i; j++)
+                if (hash[keys[i]] == hash[keys[j]])
+                    ok = 0;
+        uint32_t pilot = 0;
+        while (ok) {
+            size_t placed = 0;
+            while (placed < size) {
+                uint64_t s = frozenSlot(frozen, hash[keys[first + placed]], pilot);
+                if (taken[s])
+                    break;
+                taken[s] = 1;
+                slot[keys[first + placed]] = s;
+                placed++;
+            }
+            if (placed == size)
+                break;
+            while (placed--)
+                taken[slot[keys[first + placed]]] = 0;
+            if (++pilot == MAX_PILOT)
+                ok = 0;
+        }
+        frozen->pilot[b] = pilot;
+    }
+    free(taken);
+    free(order);
+    free(keys);
+    free(start);
+    return ok;
+}
+
+// Builds the frozen form of count entries. Takes over the key and value strings, which
+// are copied into the block and freed, but not the two arrays.
+static inline Frozen* freezeEntries(char** key, char** value, size_t count) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++)
+        bytes += strlen(key[i]) + strlen(value[i]) + 2;
+    Frozen* frozen = (Frozen*)malloc(sizeof(Frozen));
+    frozen->count = count;
+    frozen->buckets = count / FROZEN_BUCKET_KEYS + 1;
+    frozen->bytes = bytes;
+    frozen->pilot = (uint32_t*)malloc(frozen->buckets * sizeof(uint32_t));
+    frozen->entry = (FrozenEntry*)malloc((count + 1) * sizeof(FrozenEntry));
+    frozen->strings = (char*)malloc(bytes + 1);
+    uint64_t* hash = (uint64_t*)malloc((count + 1) * sizeof(uint64_t));
+    uint64_t* slot = (uint64_t*)malloc((count + 1) * sizeof(uint64_t));
+    frozen->seed = 0;
+    do {
+        frozen->seed++;
+        for (size_t i = 0; i < count; i++)
+            hash[i] = seededHash(key[i], frozen->seed);
+    } while (!placeKeys(frozen, hash, slot));
+
+    // Strings go in slot order, so neighbouring slots are neighbours in memory too.
+    char** keyAt = (char**)malloc((count + 1) * sizeof(char*));
+    char** valueAt = (char**)malloc((count + 1) * sizeof(char*));
+    for (size_t i = 0; i < count; i++) {
+        keyAt[slot[i]] = key[i];
+        valueAt[slot[i]] = value[i];
+        frozen->entry[slot[i]].hash = hash[i];
+    }
+    char* end = frozen->strings;
+    for (size_t i = 0; i < count; i++) {
+        frozen->entry[i].offset = end - frozen->strings;
+        end = stpcpy(end, keyAt[i]) + 1;
+        end = stpcpy(end, valueAt[i]) + 1;
+        free(keyAt[i]);
+        free(valueAt[i]);
+    }
+    free(keyAt);
+    free(valueAt);
+    free(hash);
+    free(slot);
+    return frozen;
+}
+
+// The file is the header fields followed by the three arrays as they are in memory,
+// so it only loads on machines with the same byte order. Returns 0 on failure.
+static inline int saveFrozen(Frozen* frozen, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return 0;
+    int ok = fwrite("T3MPHF01", 1, 8, file) == 8
+          && fwrite(&frozen->seed, sizeof(uint64_t), 4, file) == 4
+          && fwrite(frozen->pilot, sizeof(uint32_t), frozen->buckets, file) == frozen->buckets
+          && fwrite(frozen->entry, sizeof(FrozenEntry), frozen->count, file) == frozen->count
+          && fwrite(frozen->strings, 1, frozen->bytes, file) == frozen->bytes;
+    return fclose(file) == 0 && ok;
+}
+
+// Reads a file written by saveFrozen, no hashing or placing needed. Returns NULL when
+// the file cannot be read, its length does not match the sizes in its header, memory
+// runs out or a key or value would run past the end of the strings. The length is
+// checked before anything is allocated, so a crafted header cannot ask for more than
+// the file holds.
+static inline Frozen* loadFrozen(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    char magic[8];
+    uint64_t header[4], size = 0, part;
+    int ok = fread(magic, 1, 8, file) == 8 && !memcmp(magic, "T3MPHF01", 8)
+          && fread(header, sizeof(uint64_t), 4, file) == 4
+          && header[2] == header[1] / FROZEN_BUCKET_KEYS + 1 && header[1] <= header[3]
+          && !__builtin_mul_overflow(header[2], sizeof(uint32_t), &part)
+          && !__builtin_add_overflow(8 + sizeof(header), part, &size)
+          && !__builtin_mul_overflow(header[1], sizeof(FrozenEntry), &part)
+          && !__builtin_add_overflow(size, part, &size)
+          && !__builtin_add_overflow(size, header[3], &size)
+          && !fseek(file, 0, SEEK_END) && (uint64_t)ftell(file) == size
+          && !fseek(file, 8 + sizeof(header), SEEK_SET);
+    Frozen* frozen = ok ? (Frozen*)calloc(1, sizeof(Frozen)) : NULL;
+    if (!frozen) {
+        fclose(file);
+        return NULL;
+    }
+    frozen->seed = header[0];
+    frozen->count = header[1];
+    frozen->buckets = header[2];
+    frozen->bytes = header[3];
+    frozen->pilot = (uint32_t*)malloc(frozen->buckets * sizeof(uint32_t));
+    frozen->entry = (FrozenEntry*)malloc((frozen->count + 1) * sizeof(FrozenEntry));
+    frozen->strings = (char*)malloc(frozen->bytes + 1);
+    if (!frozen->pilot || !frozen->entry || !frozen->strings) {
+        fclose(file);
+        freeFrozen(frozen);
+        return NULL;
+    }
+    ok = fread(frozen->pilot, sizeof(uint32_t), frozen->buckets, file) == frozen->buckets
+         && fread(frozen->entry, sizeof(FrozenEntry), frozen->count, file) == frozen->count
+         && fread(frozen->strings, 1, frozen->bytes, file) == frozen->bytes
+         && fgetc(file) == EOF;
+    fclose(file);
+    // Every key and value has to end inside strings.
+    frozen->strings[frozen->bytes] = '\0';
+    for (size_t i = 0; i < frozen->count && ok; i++) {
+        uint64_t entry = frozen->entry[i].offset;
+        ok = entry < frozen->bytes && (entry += strlen(frozen->strings + entry) + 1) < frozen->bytes
+             && entry + strlen(frozen->strings + entry) < frozen->bytes;
+    }
+    if (!ok) {
+        freeFrozen(frozen);
+        return NULL;
+    }
+    return frozen;
+}
+
+#endif
@@ -0,0 +1,111 @@
+// Buffered output shared by the tree and table dumps. Text is collected in a large
+// user-space buffer and handed to the kernel with writev, without printf parsing.
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    int fd;
+    char* buffer;
+    size_t used;
+    size_t size;
+} Output;
+
+// Writes every iovec, retrying after partial writes and interrupts.
+static inline void writeAll(int fd, struct iovec* iov, int count) {
+    while (count) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (count && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+// Anything already printed through stdio is flushed first so the order is kept.
+static inline Output* newOutput(int fd) {
+    fflush(stdout);
+    Output* ret = (Output*)malloc(sizeof(Output));
+    ret->fd = fd;
+    ret->size = OUTPUT_BUFFER_SIZE;
+    ret->buffer = (char*)malloc(ret->size);
+    ret->used = 0;
+    return ret;
+}
+
+static inline void flushOutput(Output* out) {
+    struct iovec iov = {out->buffer, out->used};
+    writeAll(out->fd, &iov, 1);
+    out->used = 0;
+}
+
+static inline void freeOutput(Output* out) {
+    flushOutput(out);
+    free(out->buffer);
+    free(out);
+}
+
+// Chunks that do not fit go out in the same writev as the buffer instead of being copied.
+static inline void outputBytes(Output* out, const char* bytes, size_t size) {
+    if (out->size - out->used < size) {
+        struct iovec iov[2] = {{out->buffer, out->used}, {(void*)bytes, size}};
+        writeAll(out->fd, iov, 2);
+        out->used = 0;
+        return;
+    }
+    memcpy(out->buffer + out->used, bytes, size);
+    out->used += size;
+}
+
+static inline void outputString(Output* out, const char* string) {
+    outputBytes(out, string, strlen(string));
+}
+
+static inline void outputChar(Output* out, char c) {
+    if (out->used == out->size)
+        flushOutput(out);
+    out->buffer[out->used++] = c;
+}
+
+static inline void outputRepeat(Output* out, char c, size_t count) {
+    while (count) {
+        if (out->used == out->size)
+            flushOutput(out);
+        size_t chunk = out->size - out->used;
+        chunk = (chunk < count) ? chunk : count;
+        memset(out->buffer + out->used, c, chunk);
+        out->used += chunk;
+        count -= chunk;
+    }
+}
+
+static inline void outputUnsigned(Output* out, unsigned long value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    outputBytes(out, digits + sizeof(digits) - count, count);
+}
+
+#endif
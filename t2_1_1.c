@@ -13,88 +13,263 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#define NIL UINT32_MAX
 
 struct node {
-    struct node *left;
-    struct node *right;
+    uint32_t left;
+    uint32_t right;
     int value;
 };
 
+// Nodes live in one array and refer to their children by index. Children are always
+// created before their parent, so evaluation is a single forward scan over the array.
 typedef struct ExprTree {
-    struct node *root;
+    struct node *nodes;
+    double *values;
+    uint32_t used;
+    uint32_t size;
+    uint32_t valuesSize;
+    uint32_t root;
 } ExprTree;
 
+// Marks a prefix operator on the parser's operator stack.
+#define UNARY 'u'
+
+struct parser {
+    const char *current;
+    const char *end;
+    ExprTree *tree;
+    uint32_t *operands;
+    char *ops;
+    size_t operandsUsed;
+    size_t opsUsed;
+};
+
+ExprTree *newExprTree(uint32_t);
 ExprTree *makeTestTree();
+ExprTree *parseExprTree(const char*, const char*);
+ExprTree **parseExprTrees(const char*, size_t, size_t*);
 void freeExprTree(ExprTree*);
-void freeExprTreeNode(struct node*);
-double evalNode(struct node*);
+uint32_t newValueNode(ExprTree*, int);
+uint32_t newOpNode(ExprTree*, int, uint32_t, uint32_t);
+double evalNode(ExprTree*, uint32_t);
 double evalTree(ExprTree*);
 
-struct node *newValueNode(int value) {
-    struct node *ret = malloc(sizeof(struct node));
-    ret->left = ret->right = NULL;
-    ret->value = value;
+ExprTree *newExprTree(uint32_t size) {
+    ExprTree *ret = malloc(sizeof(ExprTree));
+    ret->size = size ? size : 1;
+    ret->nodes = malloc(sizeof(struct node) * ret->size);
+    ret->values = NULL;
+    ret->used = 0;
+    ret->valuesSize = 0;
+    ret->root = NIL;
     return ret;
 }
 
-struct node *newOpNode(int op, struct node *left, struct node *right) {
-    struct node *ret = malloc(sizeof(struct node));
+static inline struct node *reserveNode(ExprTree *tree) {
+    if (tree->used == tree->size) {
+        tree->size *= 2;
+        tree->nodes = realloc(tree->nodes, sizeof(struct node) * tree->size);
+    }
+    return &tree->nodes[tree->used++];
+}
+
+uint32_t newValueNode(ExprTree *tree, int value) {
+    struct node *ret = reserveNode(tree);
+    ret->left = ret->right = NIL;
+    ret->value = value;
+    return ret - tree->nodes;
+}
+
+uint32_t newOpNode(ExprTree *tree, int op, uint32_t left, uint32_t right) {
+    struct node *ret = reserveNode(tree);
     ret->left = left;
     ret->right = right;
     ret->value = op;
-    return ret;
+    return ret - tree->nodes;
 }
 
 ExprTree *makeTestTree() {
-    ExprTree *ret = malloc(sizeof(ExprTree));
-    ret->root = newOpNode('+',
-                          newOpNode('*',
-                                    newValueNode(11),
-                                    newOpNode('-',
-                                              newValueNode(19),
-                                              newOpNode('-',
-                                                        newValueNode(7),
-                                                        NULL))),
-                          newOpNode('/',
-                                    newValueNode(13),
-                                    newValueNode(7)));
+    ExprTree *ret = newExprTree(10);
+    // built bottom-up so the nodes are laid out in post-order
+    uint32_t left = newValueNode(ret, 11);
+    uint32_t inner = newValueNode(ret, 19);
+    inner = newOpNode(ret, '-', inner, newOpNode(ret, '-', newValueNode(ret, 7), NIL));
+    left = newOpNode(ret, '*', left, inner);
+    uint32_t right = newValueNode(ret, 13);
+    right = newOpNode(ret, '/', right, newValueNode(ret, 7));
+    ret->root = newOpNode(ret, '+', left, right);
     return ret;
 }
 
-void freeExprTreeNode(struct node *node) {
-    if (node->left)
-        freeExprTreeNode(node->left);
-    if (node->right)
-        freeExprTreeNode(node->right);
-    free(node);
+void freeExprTree(ExprTree *tree) {
+    free(tree->nodes);
+    free(tree->values);
+    free(tree);
+}
+
+static inline void skipSpaces(struct parser *parser) {
+    while (parser->current < parser->end && (*parser->current == ' ' || *parser->current == '\t' || *parser->current == '\r'))
+        parser->current++;
 }
 
-void freeExprTree(ExprTree *tree) {
-    if (tree->root) {
-        freeExprTreeNode(tree->root);
+static inline int precedence(int op) {
+    switch (op) {
+        case '+':
+        case '-':
+            return 1;
+        case '*':
+        case '/':
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// Pops the operator on top of the stack and replaces its operands with the new node.
+static void reduce(struct parser *parser) {
+    char op = parser->ops[--parser->opsUsed];
+    uint32_t *top = &parser->operands[parser->operandsUsed - 1];
+    if (op == UNARY) {
+        *top = newOpNode(parser->tree, '-', *top, NIL);
+    } else {
+        parser->operandsUsed--;
+        top[-1] = newOpNode(parser->tree, op, top[-1], *top);
     }
-    free(tree);
 }
 
-double evalNode(struct node *node) {
-    if (!node->left && !node->right)
+// Operator precedence parsing with explicit operand and operator stacks, so nesting
+// depth is bounded by the line length rather than the call stack. Operators are reduced
+// as soon as their operands are complete, which emits the nodes in post-order.
+uint32_t parseExpr(struct parser *parser) {
+    int expectOperand = 1;
+    while (1) {
+        skipSpaces(parser);
+        if (parser->current == parser->end)
+            break;
+        char c = *parser->current;
+        if (expectOperand) {
+            if (c == '(' || c == '-') {
+                parser->ops[parser->opsUsed++] = (c == '(') ? '(' : UNARY;
+                parser->current++;
+                continue;
+            }
+            uint32_t operand;
+            if (c >= '0' && c <= '9') {
+                int64_t value = 0;
+                while (parser->current < parser->end && *parser->current >= '0' && *parser->current <= '9') {
+                    value = value * 10 + (*parser->current++ - '0');
+                    if (value > INT_MAX)
+                        return NIL;
+                }
+                operand = newValueNode(parser->tree, value);
+            } else {
+                return NIL;
+            }
+            parser->operands[parser->operandsUsed++] = operand;
+            expectOperand = 0;
+        } else if (c == ')') {
+            while (parser->opsUsed && parser->ops[parser->opsUsed - 1] != '(')
+                reduce(parser);
+            if (!parser->opsUsed)
+                return NIL;
+            parser->opsUsed--;
+            parser->current++;
+        } else {
+            int opPrecedence = precedence(c);
+            if (!opPrecedence)
+                break;
+            while (parser->opsUsed) {
+                char top = parser->ops[parser->opsUsed - 1];
+                if (top == '(' || (top != UNARY && precedence(top) < opPrecedence))
+                    break;
+                reduce(parser);
+            }
+            parser->ops[parser->opsUsed++] = c;
+            parser->current++;
+            expectOperand = 1;
+        }
+    }
+    if (expectOperand)
+        return NIL;
+    while (parser->opsUsed) {
+        if (parser->ops[parser->opsUsed - 1] == '(')
+            return NIL;
+        reduce(parser);
+    }
+    return parser->operands[0];
+}
+
+// Every node consumes at least one input character, so the node array and both parser
+// stacks are sized by the line length once; the node array is trimmed afterwards.
+ExprTree *parseExprTree(const char *begin, const char *end) {
+    size_t length = end - begin;
+    ExprTree *ret = newExprTree(length);
+    struct parser parser = {begin, end, ret, malloc(sizeof(uint32_t) * length), malloc(length), 0, 0};
+    ret->root = parseExpr(&parser);
+    skipSpaces(&parser);
+    free(parser.operands);
+    free(parser.ops);
+    if (ret->root == NIL || parser.current != end) {
+        freeExprTree(ret);
+        return NULL;
+    }
+    ret->size = ret->used;
+    ret->nodes = realloc(ret->nodes, sizeof(struct node) * ret->size);
+    return ret;
+}
+
+// One formula per line, empty lines are skipped.
+ExprTree **parseExprTrees(const char *buffer, size_t size, size_t *count) {
+    size_t lines = 1;
+    for (const char *c = memchr(buffer, '\n', size); c; c = memchr(c + 1, '\n', buffer + size - c - 1))
+        lines++;
+    ExprTree **ret = malloc(sizeof(ExprTree*) * lines);
+    const char *end = buffer + size;
+    size_t line = 0;
+    *count = 0;
+    while (buffer < end) {
+        const char *lineEnd = memchr(buffer, '\n', end - buffer);
+        lineEnd = lineEnd ? lineEnd : end;
+        line++;
+        if (lineEnd != buffer) {
+            ExprTree *tree = parseExprTree(buffer, lineEnd);
+            if (tree)
+                ret[(*count)++] = tree;
+            else
+                printf("ERROR: unable to parse line %lu\n", line);
+        }
+        buffer = lineEnd + 1;
+    }
+    return ret;
+}
+
+double evalNode(ExprTree *tree, uint32_t index) {
+    struct node *node = &tree->nodes[index];
+    double *values = tree->values;
+    if (node->left == NIL && node->right == NIL)
         return node->value;
     switch (node->value) {
         case '+':
-            return evalNode(node->left) + evalNode(node->right);
+            return values[node->left] + values[node->right];
             break;
         case '*':
-            return evalNode(node->left) * evalNode(node->right);
+            return values[node->left] * values[node->right];
             break;
         case '/':
-            return evalNode(node->left) / evalNode(node->right);
+            return values[node->left] / values[node->right];
             break;
         case '-': {
-            if (!node->left)
-                return -evalNode(node->right);
-            if (!node->right)
-                return -evalNode(node->left);
-            return evalNode(node->left) - evalNode(node->right);
+            if (node->left == NIL)
+                return -values[node->right];
+            if (node->right == NIL)
+                return -values[node->left];
+            return values[node->left] - values[node->right];
             break;
         }
         default:
@@ -104,13 +279,106 @@ double evalNode(struct node *node) {
 }
 
 double evalTree(ExprTree *tree) {
-    return evalNode(tree->root);
+    if (tree->valuesSize < tree->used) {
+        tree->valuesSize = tree->used;
+        tree->values = realloc(tree->values, sizeof(double) * tree->valuesSize);
+    }
+    for (uint32_t i = 0; i < tree->used; i++)
+        tree->values[i] = evalNode(tree, i);
+    return tree->values[tree->root];
 }
 
-int main(int argc, char **argv) {
-    ExprTree *tree = makeTestTree();
+char *readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *ret = malloc(*size + 1);
+    *size = fread(ret, 1, *size, file);
+    ret[*size] = 0;
+    fclose(file);
+    return ret;
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+void benchmarkParser(const char *buffer, size_t size) {
+    size_t passes = 0;
+    size_t count = 0;
+    double start = now();
+    double elapsed;
+    do {
+        ExprTree **trees = parseExprTrees(buffer, size, &count);
+        for (size_t i = 0; i < count; i++)
+            freeExprTree(trees[i]);
+        free(trees);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    printf("parsed %lu formulas (%lu bytes) %lu times in %lf s: %lf MB/s\n",
+           count, size, passes, elapsed, size * passes / elapsed / 1e6);
+}
+
+// Parses and evaluates ((...((1-1)-1)...)-1) nested depth times.
+void stressDeepChain(size_t depth) {
+    size_t size = depth * 4 + 1;
+    char *buffer = malloc(size);
+    memset(buffer, '(', depth);
+    buffer[depth] = '1';
+    for (size_t i = 0; i < depth; i++)
+        memcpy(buffer + depth + 1 + i * 3, "-1)", 3);
+    double start = now();
+    ExprTree *tree = parseExprTree(buffer, buffer + size);
+    double parsed = now();
     double result = evalTree(tree);
-    printf("result: %lf\n", result);
+    double evaluated = now();
+    printf("depth %lu: %u nodes, result %lf, parsed in %lf s, evaluated in %lf s\n",
+           depth, tree->used, result, parsed - start, evaluated - parsed);
     freeExprTree(tree);
+    free(buffer);
+}
+
+// usage: t2_1_1 [-b] [file]
+//        t2_1_1 -s <depth>
+//   without arguments evaluates the built-in test tree,
+//   otherwise evaluates every formula in file (one per line),
+//   -b measures parse throughput instead,
+//   -s parses and evaluates a left-deep chain of the given depth
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "-s")) {
+        stressDeepChain(atol(argv[2]));
+        return 0;
+    }
+    if (argc == 1) {
+        ExprTree *tree = makeTestTree();
+        double result = evalTree(tree);
+        printf("result: %lf\n", result);
+        freeExprTree(tree);
+        return 0;
+    }
+    size_t size;
+    char *buffer = readFile(argv[argc - 1], &size);
+    if (!buffer) {
+        printf("ERROR: unable to read %s\n", argv[argc - 1]);
+        return 1;
+    }
+    if (argc == 3 && !strcmp(argv[1], "-b")) {
+        benchmarkParser(buffer, size);
+    } else {
+        size_t count;
+        ExprTree **trees = parseExprTrees(buffer, size, &count);
+        for (size_t i = 0; i < count; i++) {
+            printf("result: %lf\n", evalTree(trees[i]));
+            freeExprTree(trees[i]);
+        }
+        free(trees);
+    }
+    free(buffer);
     return 0;
 }
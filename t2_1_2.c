@@ -13,15 +13,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
 
+#define NIL 0x3fffffffu
+
+enum types {
+    valueNode,
+    opNode,
+    variableNode
+};
+
+// The node type shares a word with the left child index to keep nodes at 16 bytes.
 struct node {
-    enum types {
-        valueNode,
-        opNode,
-        variableNode
-    } type;
-    struct node *left;
-    struct node *right;
+    unsigned int type : 2;
+    unsigned int left : 30;
+    uint32_t right;
     union {
         double value;
         char op;
@@ -29,10 +37,30 @@ struct node {
     } value;
 };
 
+// Nodes live in one array and refer to their children by index. Children are always
+// created before their parent, so evaluation is a single forward scan over the array.
 typedef struct ExprTree {
-    struct node *root;
+    struct node *nodes;
+    double *values;
+    uint32_t used;
+    uint32_t size;
+    uint32_t valuesSize;
+    uint32_t root;
 } ExprTree;
 
+// Marks a prefix operator on the parser's operator stack.
+#define UNARY 'u'
+
+struct parser {
+    const char *current;
+    const char *end;
+    ExprTree *tree;
+    uint32_t *operands;
+    char *ops;
+    size_t operandsUsed;
+    size_t opsUsed;
+};
+
 struct vars {
     double value;
     unsigned int valid;
@@ -40,72 +68,263 @@ struct vars {
 
 struct vars vars[256];
 
-struct node *newValueNode(double);
-struct node *newOpNode(char, struct node*, struct node*);
-struct node *newVarNode(char);
+// xmm0..xmm14 hold intermediate results, xmm15 keeps the sign mask used for negation.
+#define JIT_REGISTERS 15
+
+typedef struct CompiledExpr {
+    double (*function)(const struct vars*);
+    size_t size;
+} CompiledExpr;
+
+struct emitter {
+    unsigned char *code;
+    size_t used;
+};
+
+struct jitFrame {
+    uint32_t node;
+    unsigned int reg;
+    int state;
+};
+
+ExprTree *newExprTree(uint32_t);
+uint32_t newValueNode(ExprTree*, double);
+uint32_t newOpNode(ExprTree*, char, uint32_t, uint32_t);
+uint32_t newVarNode(ExprTree*, char);
 ExprTree *makeTestTree();
+ExprTree *parseExprTree(const char*, const char*);
+ExprTree **parseExprTrees(const char*, size_t, size_t*);
 void freeExprTree(ExprTree*);
-void freeExprTreeNode(struct node*);
-double evalNode(struct node*);
+double evalNode(ExprTree*, uint32_t);
 double evalTree(ExprTree*);
+void bindVars(ExprTree*);
+CompiledExpr *compileExprTree(ExprTree*);
+void freeCompiledExpr(CompiledExpr*);
+double evalTreeJit(ExprTree*);
+
+ExprTree *newExprTree(uint32_t size) {
+    ExprTree *ret = malloc(sizeof(ExprTree));
+    ret->size = size ? size : 1;
+    ret->nodes = malloc(sizeof(struct node) * ret->size);
+    ret->values = NULL;
+    ret->used = 0;
+    ret->valuesSize = 0;
+    ret->root = NIL;
+    return ret;
+}
 
-struct node *newValueNode(double value) {
-    struct node *ret = malloc(sizeof(struct node));
+static inline struct node *reserveNode(ExprTree *tree) {
+    if (tree->used == tree->size) {
+        tree->size *= 2;
+        tree->nodes = realloc(tree->nodes, sizeof(struct node) * tree->size);
+    }
+    return &tree->nodes[tree->used++];
+}
+
+uint32_t newValueNode(ExprTree *tree, double value) {
+    struct node *ret = reserveNode(tree);
     ret->type = valueNode;
-    ret->left = ret->right = NULL;
+    ret->left = ret->right = NIL;
     ret->value.value = value;
-    return ret;
+    return ret - tree->nodes;
 }
 
-struct node *newOpNode(char op, struct node *left, struct node *right) {
-    struct node *ret = malloc(sizeof(struct node));
+uint32_t newOpNode(ExprTree *tree, char op, uint32_t left, uint32_t right) {
+    struct node *ret = reserveNode(tree);
     ret->type = opNode;
     ret->left = left;
     ret->right = right;
     ret->value.op = op;
-    return ret;
+    return ret - tree->nodes;
 }
 
-struct node *newVarNode(char name) {
-    struct node *ret = malloc(sizeof(struct node));
+uint32_t newVarNode(ExprTree *tree, char name) {
+    struct node *ret = reserveNode(tree);
     ret->type = variableNode;
-    ret->left = ret->right = NULL;
+    ret->left = ret->right = NIL;
     ret->value.var = name;
-    return ret;
+    return ret - tree->nodes;
 }
 
 ExprTree *makeTestTree() {
-    ExprTree *ret = malloc(sizeof(ExprTree));
-    ret->root = newOpNode('+',
-                          newOpNode('*',
-                                    newVarNode('c'),
-                                    newOpNode('-',
-                                              newVarNode('b'),
-                                              newOpNode('-',
-                                                        newVarNode('a'),
-                                                        NULL))),
-                          newOpNode('/',
-                                    newVarNode('b'),
-                                    newVarNode('a')));
+    ExprTree *ret = newExprTree(10);
+    // built bottom-up so the nodes are laid out in post-order
+    uint32_t left = newVarNode(ret, 'c');
+    uint32_t inner = newVarNode(ret, 'b');
+    inner = newOpNode(ret, '-', inner, newOpNode(ret, '-', newVarNode(ret, 'a'), NIL));
+    left = newOpNode(ret, '*', left, inner);
+    uint32_t right = newVarNode(ret, 'b');
+    right = newOpNode(ret, '/', right, newVarNode(ret, 'a'));
+    ret->root = newOpNode(ret, '+', left, right);
     return ret;
 }
 
-void freeExprTreeNode(struct node *node) {
-    if (node->left)
-        freeExprTreeNode(node->left);
-    if (node->right)
-        freeExprTreeNode(node->right);
-    free(node);
+void freeExprTree(ExprTree *tree) {
+    free(tree->nodes);
+    free(tree->values);
+    free(tree);
 }
 
-void freeExprTree(ExprTree *tree) {
-    if (tree->root) {
-        freeExprTreeNode(tree->root);
+static inline void skipSpaces(struct parser *parser) {
+    while (parser->current < parser->end && (*parser->current == ' ' || *parser->current == '\t' || *parser->current == '\r'))
+        parser->current++;
+}
+
+static inline int isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline int isVariable(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline int precedence(int op) {
+    switch (op) {
+        case '+':
+        case '-':
+            return 1;
+        case '*':
+        case '/':
+            return 2;
+        default:
+            return 0;
     }
-    free(tree);
 }
 
-double evalNode(struct node *node) {
+// Decimal literal without exponent, read in place so the line is never copied or terminated.
+static double parseNumber(struct parser *parser) {
+    unsigned long mantissa = 0;
+    double scale = 1.0;
+    while (parser->current < parser->end && isDigit(*parser->current))
+        mantissa = mantissa * 10 + (*parser->current++ - '0');
+    if (parser->current < parser->end && *parser->current == '.') {
+        parser->current++;
+        while (parser->current < parser->end && isDigit(*parser->current)) {
+            mantissa = mantissa * 10 + (*parser->current++ - '0');
+            scale *= 10.0;
+        }
+    }
+    return mantissa / scale;
+}
+
+// Pops the operator on top of the stack and replaces its operands with the new node.
+static void reduce(struct parser *parser) {
+    char op = parser->ops[--parser->opsUsed];
+    uint32_t *top = &parser->operands[parser->operandsUsed - 1];
+    if (op == UNARY) {
+        *top = newOpNode(parser->tree, '-', *top, NIL);
+    } else {
+        parser->operandsUsed--;
+        top[-1] = newOpNode(parser->tree, op, top[-1], *top);
+    }
+}
+
+// Operator precedence parsing with explicit operand and operator stacks, so nesting
+// depth is bounded by the line length rather than the call stack. Operators are reduced
+// as soon as their operands are complete, which emits the nodes in post-order.
+uint32_t parseExpr(struct parser *parser) {
+    int expectOperand = 1;
+    while (1) {
+        skipSpaces(parser);
+        if (parser->current == parser->end)
+            break;
+        char c = *parser->current;
+        if (expectOperand) {
+            if (c == '(' || c == '-') {
+                parser->ops[parser->opsUsed++] = (c == '(') ? '(' : UNARY;
+                parser->current++;
+                continue;
+            }
+            uint32_t operand;
+            if (isDigit(c) || c == '.') {
+                operand = newValueNode(parser->tree, parseNumber(parser));
+            } else if (isVariable(c)) {
+                parser->current++;
+                operand = newVarNode(parser->tree, c);
+            } else {
+                return NIL;
+            }
+            parser->operands[parser->operandsUsed++] = operand;
+            expectOperand = 0;
+        } else if (c == ')') {
+            while (parser->opsUsed && parser->ops[parser->opsUsed - 1] != '(')
+                reduce(parser);
+            if (!parser->opsUsed)
+                return NIL;
+            parser->opsUsed--;
+            parser->current++;
+        } else {
+            int opPrecedence = precedence(c);
+            if (!opPrecedence)
+                break;
+            while (parser->opsUsed) {
+                char top = parser->ops[parser->opsUsed - 1];
+                if (top == '(' || (top != UNARY && precedence(top) < opPrecedence))
+                    break;
+                reduce(parser);
+            }
+            parser->ops[parser->opsUsed++] = c;
+            parser->current++;
+            expectOperand = 1;
+        }
+    }
+    if (expectOperand)
+        return NIL;
+    while (parser->opsUsed) {
+        if (parser->ops[parser->opsUsed - 1] == '(')
+            return NIL;
+        reduce(parser);
+    }
+    return parser->operands[0];
+}
+
+// Every node consumes at least one input character, so the node array and both parser
+// stacks are sized by the line length once; the node array is trimmed afterwards.
+ExprTree *parseExprTree(const char *begin, const char *end) {
+    size_t length = end - begin;
+    ExprTree *ret = newExprTree(length);
+    struct parser parser = {begin, end, ret, malloc(sizeof(uint32_t) * length), malloc(length), 0, 0};
+    ret->root = parseExpr(&parser);
+    skipSpaces(&parser);
+    free(parser.operands);
+    free(parser.ops);
+    if (ret->root == NIL || parser.current != end) {
+        freeExprTree(ret);
+        return NULL;
+    }
+    ret->size = ret->used;
+    ret->nodes = realloc(ret->nodes, sizeof(struct node) * ret->size);
+    return ret;
+}
+
+// One formula per line, empty lines are skipped.
+ExprTree **parseExprTrees(const char *buffer, size_t size, size_t *count) {
+    size_t lines = 1;
+    for (const char *c = memchr(buffer, '\n', size); c; c = memchr(c + 1, '\n', buffer + size - c - 1))
+        lines++;
+    ExprTree **ret = malloc(sizeof(ExprTree*) * lines);
+    const char *end = buffer + size;
+    size_t line = 0;
+    *count = 0;
+    while (buffer < end) {
+        const char *lineEnd = memchr(buffer, '\n', end - buffer);
+        lineEnd = lineEnd ? lineEnd : end;
+        line++;
+        if (lineEnd != buffer) {
+            ExprTree *tree = parseExprTree(buffer, lineEnd);
+            if (tree)
+                ret[(*count)++] = tree;
+            else
+                printf("ERROR: unable to parse line %lu\n", line);
+        }
+        buffer = lineEnd + 1;
+    }
+    return ret;
+}
+
+double evalNode(ExprTree *tree, uint32_t index) {
+    struct node *node = &tree->nodes[index];
+    double *values = tree->values;
     if (node->type == valueNode)
         return node->value.value;
     else if (node->type == variableNode) {
@@ -118,20 +337,20 @@ double evalNode(struct node *node) {
     }
     switch (node->value.op) {
         case '+':
-            return evalNode(node->left) + evalNode(node->right);
+            return values[node->left] + values[node->right];
             break;
         case '*':
-            return evalNode(node->left) * evalNode(node->right);
+            return values[node->left] * values[node->right];
             break;
         case '/':
-            return evalNode(node->left) / evalNode(node->right);
+            return values[node->left] / values[node->right];
             break;
         case '-': {
-            if (!node->left)
-                return -evalNode(node->right);
-            if (!node->right)
-                return -evalNode(node->left);
-            return evalNode(node->left) - evalNode(node->right);
+            if (node->left == NIL)
+                return -values[node->right];
+            if (node->right == NIL)
+                return -values[node->left];
+            return values[node->left] - values[node->right];
             break;
         }
         default:
@@ -141,13 +360,318 @@ double evalNode(struct node *node) {
 }
 
 double evalTree(ExprTree *tree) {
-    return evalNode(tree->root);
+    if (tree->valuesSize < tree->used) {
+        tree->valuesSize = tree->used;
+        tree->values = realloc(tree->values, sizeof(double) * tree->valuesSize);
+    }
+    for (uint32_t i = 0; i < tree->used; i++)
+        tree->values[i] = evalNode(tree, i);
+    return tree->values[tree->root];
+}
+
+// Asks for every unbound variable in the order evalTree would.
+void bindVars(ExprTree *tree) {
+    for (uint32_t i = 0; i < tree->used; i++)
+        if (tree->nodes[i].type == variableNode)
+            evalNode(tree, i);
+}
+
+static inline void emitByte(struct emitter *emitter, unsigned char byte) {
+    emitter->code[emitter->used++] = byte;
+}
+
+static inline void emitBytes(struct emitter *emitter, const void *bytes, size_t size) {
+    memcpy(emitter->code + emitter->used, bytes, size);
+    emitter->used += size;
+}
+
+// <prefix> [REX] 0F <opcode> with a register to register ModRM
+static void emitSse(struct emitter *emitter, unsigned char prefix, unsigned char opcode, unsigned int reg, unsigned int rm) {
+    emitByte(emitter, prefix);
+    if (reg >= 8 || rm >= 8)
+        emitByte(emitter, 0x40 | ((reg >= 8) << 2) | (rm >= 8));
+    emitByte(emitter, 0x0f);
+    emitByte(emitter, opcode);
+    emitByte(emitter, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// movsd xmm, [rdi + disp32]
+static void emitLoadVar(struct emitter *emitter, unsigned int reg, int var) {
+    int32_t disp = var * sizeof(struct vars);
+    emitByte(emitter, 0xf2);
+    if (reg >= 8)
+        emitByte(emitter, 0x44);
+    emitByte(emitter, 0x0f);
+    emitByte(emitter, 0x10);
+    emitByte(emitter, 0x80 | ((reg & 7) << 3) | 7);
+    emitBytes(emitter, &disp, sizeof(disp));
+}
+
+// mov rax, imm64; movq xmm, rax
+static void emitLoadConst(struct emitter *emitter, unsigned int reg, double value) {
+    emitByte(emitter, 0x48);
+    emitByte(emitter, 0xb8);
+    emitBytes(emitter, &value, sizeof(value));
+    emitByte(emitter, 0x66);
+    emitByte(emitter, 0x48 | ((reg >= 8) << 2));
+    emitByte(emitter, 0x0f);
+    emitByte(emitter, 0x6e);
+    emitByte(emitter, 0xc0 | ((reg & 7) << 3));
+}
+
+static int sseOpcode(char op) {
+    switch (op) {
+        case '+':
+            return 0x58;
+        case '*':
+            return 0x59;
+        case '-':
+            return 0x5c;
+        case '/':
+            return 0x5e;
+        default:
+            return 0;
+    }
+}
+
+// Compiles the tree to a function taking the vars array. Registers are assigned
+// Sethi-Ullman style, the heavier operand is evaluated first. Returns NULL when the
+// target is not x86-64, the tree needs more than JIT_REGISTERS registers or holds
+// an unknown operator; the caller falls back to evalTree then.
+CompiledExpr *compileExprTree(ExprTree *tree) {
+#ifndef __x86_64__
+    return NULL;
+#else
+    uint32_t *need = malloc(sizeof(uint32_t) * tree->used);
+    int negate = 0;
+    for (uint32_t i = 0; i < tree->used; i++) {
+        struct node *node = &tree->nodes[i];
+        if (node->type != opNode) {
+            need[i] = 1;
+        } else if (!sseOpcode(node->value.op)) {
+            free(need);
+            return NULL;
+        } else if (node->left == NIL || node->right == NIL) {
+            negate = 1;
+            need[i] = need[node->left == NIL ? node->right : node->left];
+        } else {
+            uint32_t left = need[node->left];
+            uint32_t right = need[node->right];
+            need[i] = (left == right) ? left + 1 : (left > right ? left : right);
+        }
+    }
+    if (need[tree->root] > JIT_REGISTERS) {
+        free(need);
+        return NULL;
+    }
+    size_t size = (tree->used * 16 + 32 + 4095) & ~(size_t)4095;
+    unsigned char *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(need);
+        return NULL;
+    }
+    struct emitter emitter = {code, 0};
+    if (negate) {
+        emitLoadConst(&emitter, 15, -0.0);
+    }
+    struct jitFrame *stack = malloc(sizeof(struct jitFrame) * tree->used);
+    size_t top = 0;
+    stack[top++] = (struct jitFrame){tree->root, 0, 0};
+    while (top) {
+        struct jitFrame *frame = &stack[top - 1];
+        struct node *node = &tree->nodes[frame->node];
+        unsigned int reg = frame->reg;
+        if (node->type == valueNode) {
+            emitLoadConst(&emitter, reg, node->value.value);
+            top--;
+        } else if (node->type == variableNode) {
+            emitLoadVar(&emitter, reg, node->value.var);
+            top--;
+        } else if (node->left == NIL || node->right == NIL) {
+            if (frame->state++ == 0) {
+                stack[top++] = (struct jitFrame){node->left == NIL ? node->right : node->left, reg, 0};
+            } else {
+                emitSse(&emitter, 0x66, 0x57, reg, 15);
+                top--;
+            }
+        } else {
+            int rightFirst = need[node->right] > need[node->left];
+            if (frame->state == 0) {
+                frame->state = 1;
+                stack[top++] = (struct jitFrame){rightFirst ? node->right : node->left, reg, 0};
+            } else if (frame->state == 1) {
+                frame->state = 2;
+                stack[top++] = (struct jitFrame){rightFirst ? node->left : node->right, reg + 1, 0};
+            } else {
+                char op = node->value.op;
+                if (!rightFirst || op == '+' || op == '*') {
+                    emitSse(&emitter, 0xf2, sseOpcode(op), reg, reg + 1);
+                } else {
+                    emitSse(&emitter, 0xf2, sseOpcode(op), reg + 1, reg);
+                    emitSse(&emitter, 0x66, 0x28, reg, reg + 1);
+                }
+                top--;
+            }
+        }
+    }
+    emitByte(&emitter, 0xc3);
+    free(stack);
+    free(need);
+    mprotect(code, size, PROT_READ | PROT_EXEC);
+    CompiledExpr *ret = malloc(sizeof(CompiledExpr));
+    ret->function = (double (*)(const struct vars*))code;
+    ret->size = size;
+    return ret;
+#endif
+}
+
+void freeCompiledExpr(CompiledExpr *compiled) {
+    munmap((void*)compiled->function, compiled->size);
+    free(compiled);
+}
+
+double evalTreeJit(ExprTree *tree) {
+    CompiledExpr *compiled = compileExprTree(tree);
+    if (!compiled)
+        return evalTree(tree);
+    bindVars(tree);
+    double ret = compiled->function(vars);
+    freeCompiledExpr(compiled);
+    return ret;
+}
+
+char *readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *ret = malloc(*size + 1);
+    *size = fread(ret, 1, *size, file);
+    ret[*size] = 0;
+    fclose(file);
+    return ret;
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+void benchmarkParser(const char *buffer, size_t size) {
+    size_t passes = 0;
+    size_t count = 0;
+    double start = now();
+    double elapsed;
+    do {
+        ExprTree **trees = parseExprTrees(buffer, size, &count);
+        for (size_t i = 0; i < count; i++)
+            freeExprTree(trees[i]);
+        free(trees);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    printf("parsed %lu formulas (%lu bytes) %lu times in %lf s: %lf MB/s\n",
+           count, size, passes, elapsed, size * passes / elapsed / 1e6);
+}
+
+// Keeps the benchmark loops from being optimized away.
+volatile double sink;
+
+// Same variable values for every formula so that nothing is read from stdin.
+void benchmarkEval(const char *buffer, size_t size) {
+    for (int i = 0; i < 256; i++) {
+        vars[i].value = 1.0 + i % 7;
+        vars[i].valid = 1;
+    }
+    size_t count;
+    ExprTree **trees = parseExprTrees(buffer, size, &count);
+    CompiledExpr **compiled = malloc(sizeof(CompiledExpr*) * (count ? count : 1));
+    size_t nodes = 0;
+    size_t fallbacks = 0;
+    double start = now();
+    for (size_t i = 0; i < count; i++) {
+        nodes += trees[i]->used;
+        compiled[i] = compileExprTree(trees[i]);
+        fallbacks += !compiled[i];
+    }
+    double compileTime = now() - start;
+    size_t passes = 0;
+    start = now();
+    double elapsed;
+    do {
+        for (size_t i = 0; i < count; i++)
+            sink = evalTree(trees[i]);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    double interpreterTime = elapsed / passes;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!compiled[i])
+            continue;
+        double expected = evalTree(trees[i]);
+        double actual = compiled[i]->function(vars);
+        if (memcmp(&expected, &actual, sizeof(double)))
+            mismatches++;
+    }
+    passes = 0;
+    start = now();
+    do {
+        for (size_t i = 0; i < count; i++)
+            sink = compiled[i] ? compiled[i]->function(vars) : evalTree(trees[i]);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    double jitTime = elapsed / passes;
+    printf("%lu formulas, %lu nodes, %lu interpreted fallbacks, compiled in %lf s\n", count, nodes, fallbacks, compileTime);
+    printf("interpreter: %lf ns/node\n", interpreterTime / nodes * 1e9);
+    printf("jit: %lf ns/node (%lfx), %lu mismatches\n", jitTime / nodes * 1e9, interpreterTime / jitTime, mismatches);
+    for (size_t i = 0; i < count; i++) {
+        if (compiled[i])
+            freeCompiledExpr(compiled[i]);
+        freeExprTree(trees[i]);
+    }
+    free(compiled);
+    free(trees);
 }
 
+// usage: t2_1_2 [-b|-e|-j] [file]
+//   without a file uses the built-in test tree,
+//   otherwise evaluates every formula in file (one per line),
+//   -j evaluates through the JIT when the formula can be compiled,
+//   -b measures parse throughput instead,
+//   -e compares interpreter and JIT evaluation speed
 int main(int argc, char **argv) {
-    ExprTree *tree = makeTestTree();
-    double result = evalTree(tree);
-    printf("result: %lf\n", result);
-    freeExprTree(tree);
+    int jit = argc > 1 && !strcmp(argv[1], "-j");
+    if (argc == 1 + jit) {
+        ExprTree *tree = makeTestTree();
+        double result = jit ? evalTreeJit(tree) : evalTree(tree);
+        printf("result: %lf\n", result);
+        freeExprTree(tree);
+        return 0;
+    }
+    size_t size;
+    char *buffer = readFile(argv[argc - 1], &size);
+    if (!buffer) {
+        printf("ERROR: unable to read %s\n", argv[argc - 1]);
+        return 1;
+    }
+    if (argc == 3 && !strcmp(argv[1], "-b")) {
+        benchmarkParser(buffer, size);
+    } else if (argc == 3 && !strcmp(argv[1], "-e")) {
+        benchmarkEval(buffer, size);
+    } else {
+        size_t count;
+        ExprTree **trees = parseExprTrees(buffer, size, &count);
+        for (size_t i = 0; i < count; i++) {
+            printf("result: %lf\n", jit ? evalTreeJit(trees[i]) : evalTree(trees[i]));
+            freeExprTree(trees[i]);
+        }
+        free(trees);
+    }
+    free(buffer);
     return 0;
 }
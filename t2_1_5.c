@@ -13,17 +13,66 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
 
+#define NIL 0x3fffffffu
+
+#if defined(__AVX512F__)
+#define BLOCK_BYTES 64
+#elif defined(__AVX2__)
+#define BLOCK_BYTES 32
+#else
+#define BLOCK_BYTES 16
+#endif
+#define BLOCK_WORDS (BLOCK_BYTES / 8)
+#define BLOCK_BITS (BLOCK_BYTES * 8)
+
+// One bit per input assignment. Bitwise operators on this type compile to SSE2, AVX2 or
+// AVX-512 instructions depending on the target.
+typedef uint64_t block __attribute__((vector_size(BLOCK_BYTES)));
+
+enum types {
+    valueNode,
+    opNode,
+    variableNode
+};
+
+// The node type shares a word with the left child index, value holds the constant, the
+// operator or the variable name depending on it.
 struct node {
-    struct node *left;
-    struct node *right;
+    unsigned int type : 2;
+    unsigned int left : 30;
+    uint32_t right;
     int value;
 };
 
+// Nodes live in one array and refer to their children by index. Children are always
+// created before their parent, so evaluation is a single forward scan over the array.
 typedef struct ExprTree {
-    struct node *root;
+    struct node *nodes;
+    unsigned int *values;
+    uint32_t used;
+    uint32_t size;
+    uint32_t valuesSize;
+    uint32_t root;
 } ExprTree;
 
+// Marks a prefix operator on the parser's operator stack.
+#define UNARY 'u'
+
+struct parser {
+    const char *current;
+    const char *end;
+    ExprTree *tree;
+    uint32_t *operands;
+    char *ops;
+    size_t operandsUsed;
+    size_t opsUsed;
+};
+
 struct vars {
     unsigned int value;
     unsigned int valid;
@@ -31,95 +80,276 @@ struct vars {
 
 struct vars vars[26];
 
-struct node *newValueNode(int);
-struct node *newOpNode(int, struct node*, struct node*);
-struct node *newVarNode(char);
+// Caller-saved general purpose registers other than rdi, which holds the vars array.
+// The first one is eax so the root result is already the return value.
+static const unsigned int jitRegisters[] = {0, 1, 2, 6, 8, 9, 10, 11};
+#define JIT_REGISTERS (sizeof(jitRegisters) / sizeof(jitRegisters[0]))
+
+typedef struct CompiledExpr {
+    unsigned int (*function)(const struct vars*);
+    size_t size;
+} CompiledExpr;
+
+struct emitter {
+    unsigned char *code;
+    size_t used;
+};
+
+struct jitFrame {
+    uint32_t node;
+    unsigned int reg;
+    int state;
+};
+
+ExprTree *newExprTree(uint32_t);
+uint32_t newValueNode(ExprTree*, int);
+uint32_t newOpNode(ExprTree*, int, uint32_t, uint32_t);
+uint32_t newVarNode(ExprTree*, char);
 ExprTree *makeTestTree();
+ExprTree *parseExprTree(const char*, const char*);
+ExprTree **parseExprTrees(const char*, size_t, size_t*);
 void freeExprTree(ExprTree*);
-void freeExprTreeNode(struct node*);
-unsigned int evalNode(struct node*);
+unsigned int evalNode(ExprTree*, uint32_t);
 unsigned int evalTree(ExprTree*);
+block evalNodeSliced(ExprTree*, uint32_t, const block*, const block*, unsigned int);
+unsigned int collectVars(ExprTree*, char*);
+uint64_t *evalTruthTable(ExprTree*, const char*, unsigned int, unsigned int);
+void printTruthTable(ExprTree*);
+void bindVars(ExprTree*);
+CompiledExpr *compileExprTree(ExprTree*);
+void freeCompiledExpr(CompiledExpr*);
+unsigned int evalTreeJit(ExprTree*);
 
-struct node *newValueNode(int value) {
-    struct node *ret = malloc(sizeof(struct node));
-    ret->left = ret->right = NULL;
-    ret->value = value;
+ExprTree *newExprTree(uint32_t size) {
+    ExprTree *ret = malloc(sizeof(ExprTree));
+    ret->size = size ? size : 1;
+    ret->nodes = malloc(sizeof(struct node) * ret->size);
+    ret->values = NULL;
+    ret->used = 0;
+    ret->valuesSize = 0;
+    ret->root = NIL;
     return ret;
 }
 
-struct node *newOpNode(int op, struct node *left, struct node *right) {
-    struct node *ret = malloc(sizeof(struct node));
+static inline struct node *reserveNode(ExprTree *tree) {
+    if (tree->used == tree->size) {
+        tree->size *= 2;
+        tree->nodes = realloc(tree->nodes, sizeof(struct node) * tree->size);
+    }
+    return &tree->nodes[tree->used++];
+}
+
+uint32_t newValueNode(ExprTree *tree, int value) {
+    struct node *ret = reserveNode(tree);
+    ret->type = valueNode;
+    ret->left = ret->right = NIL;
+    ret->value = value;
+    return ret - tree->nodes;
+}
+
+uint32_t newOpNode(ExprTree *tree, int op, uint32_t left, uint32_t right) {
+    struct node *ret = reserveNode(tree);
+    ret->type = opNode;
     ret->left = left;
     ret->right = right;
     ret->value = op;
-    return ret;
+    return ret - tree->nodes;
 }
 
-struct node *newVarNode(char name) {
-    struct node *ret = malloc(sizeof(struct node));
-    ret->left = ret->right = NULL;
+uint32_t newVarNode(ExprTree *tree, char name) {
+    struct node *ret = reserveNode(tree);
+    ret->type = variableNode;
+    ret->left = ret->right = NIL;
     ret->value = name;
-    return ret;
+    return ret - tree->nodes;
 }
 
 ExprTree *makeTestTree() {
-    ExprTree *ret = malloc(sizeof(ExprTree));
-    ret->root = newOpNode('^',
-                          newOpNode('&',
-                                    newVarNode('c'),
-                                    newOpNode('^',
-                                              newVarNode('b'),
-                                              newOpNode('~',
-                                                        newVarNode('a'),
-                                                        NULL))),
-                          newOpNode('|',
-                                    newVarNode('b'),
-                                    newVarNode('a')));
+    ExprTree *ret = newExprTree(10);
+    // built bottom-up so the nodes are laid out in post-order
+    uint32_t left = newVarNode(ret, 'c');
+    uint32_t inner = newVarNode(ret, 'b');
+    inner = newOpNode(ret, '^', inner, newOpNode(ret, '~', newVarNode(ret, 'a'), NIL));
+    left = newOpNode(ret, '&', left, inner);
+    uint32_t right = newVarNode(ret, 'b');
+    right = newOpNode(ret, '|', right, newVarNode(ret, 'a'));
+    ret->root = newOpNode(ret, '^', left, right);
     return ret;
 }
 
-void freeExprTreeNode(struct node *node) {
-    if (node->left)
-        freeExprTreeNode(node->left);
-    if (node->right)
-        freeExprTreeNode(node->right);
-    free(node);
+void freeExprTree(ExprTree *tree) {
+    free(tree->nodes);
+    free(tree->values);
+    free(tree);
+}
+
+static inline void skipSpaces(struct parser *parser) {
+    while (parser->current < parser->end && (*parser->current == ' ' || *parser->current == '\t' || *parser->current == '\r'))
+        parser->current++;
 }
 
-void freeExprTree(ExprTree *tree) {
-    if (tree->root) {
-        freeExprTreeNode(tree->root);
+static inline int precedence(int op) {
+    switch (op) {
+        case '|':
+            return 1;
+        case '^':
+            return 2;
+        case '&':
+            return 3;
+        default:
+            return 0;
     }
-    free(tree);
 }
 
-unsigned int evalNode(struct node *node) {
-    if (!node->left && !node->right) {
-        if (node->value >= 'a' && node->value <= 'z') {
-            if (!vars[node->value - 'a'].valid) {
-                printf("enter variable %c: ", node->value);
-                scanf("%d", &(vars[node->value - 'a'].value));
-                vars[node->value - 'a'].valid = 1;
+// Pops the operator on top of the stack and replaces its operands with the new node.
+static void reduce(struct parser *parser) {
+    char op = parser->ops[--parser->opsUsed];
+    uint32_t *top = &parser->operands[parser->operandsUsed - 1];
+    if (op == UNARY) {
+        *top = newOpNode(parser->tree, '~', *top, NIL);
+    } else {
+        parser->operandsUsed--;
+        top[-1] = newOpNode(parser->tree, op, top[-1], *top);
+    }
+}
+
+// Operator precedence parsing with explicit operand and operator stacks, so nesting
+// depth is bounded by the line length rather than the call stack. Operators are reduced
+// as soon as their operands are complete, which emits the nodes in post-order.
+uint32_t parseExpr(struct parser *parser) {
+    int expectOperand = 1;
+    while (1) {
+        skipSpaces(parser);
+        if (parser->current == parser->end)
+            break;
+        char c = *parser->current;
+        if (expectOperand) {
+            if (c == '(' || c == '~') {
+                parser->ops[parser->opsUsed++] = (c == '(') ? '(' : UNARY;
+                parser->current++;
+                continue;
+            }
+            uint32_t operand;
+            if (c >= '0' && c <= '9') {
+                int64_t value = 0;
+                while (parser->current < parser->end && *parser->current >= '0' && *parser->current <= '9') {
+                    value = value * 10 + (*parser->current++ - '0');
+                    if (value > INT_MAX)
+                        return NIL;
+                }
+                operand = newValueNode(parser->tree, value);
+            } else if (c >= 'a' && c <= 'z') {
+                parser->current++;
+                operand = newVarNode(parser->tree, c);
+            } else {
+                return NIL;
+            }
+            parser->operands[parser->operandsUsed++] = operand;
+            expectOperand = 0;
+        } else if (c == ')') {
+            while (parser->opsUsed && parser->ops[parser->opsUsed - 1] != '(')
+                reduce(parser);
+            if (!parser->opsUsed)
+                return NIL;
+            parser->opsUsed--;
+            parser->current++;
+        } else {
+            int opPrecedence = precedence(c);
+            if (!opPrecedence)
+                break;
+            while (parser->opsUsed) {
+                char top = parser->ops[parser->opsUsed - 1];
+                if (top == '(' || (top != UNARY && precedence(top) < opPrecedence))
+                    break;
+                reduce(parser);
             }
-            return vars[node->value - 'a'].value;
+            parser->ops[parser->opsUsed++] = c;
+            parser->current++;
+            expectOperand = 1;
         }
-        return node->value;
     }
+    if (expectOperand)
+        return NIL;
+    while (parser->opsUsed) {
+        if (parser->ops[parser->opsUsed - 1] == '(')
+            return NIL;
+        reduce(parser);
+    }
+    return parser->operands[0];
+}
+
+// Every node consumes at least one input character, so the node array and both parser
+// stacks are sized by the line length once; the node array is trimmed afterwards.
+ExprTree *parseExprTree(const char *begin, const char *end) {
+    size_t length = end - begin;
+    ExprTree *ret = newExprTree(length);
+    struct parser parser = {begin, end, ret, malloc(sizeof(uint32_t) * length), malloc(length), 0, 0};
+    ret->root = parseExpr(&parser);
+    skipSpaces(&parser);
+    free(parser.operands);
+    free(parser.ops);
+    if (ret->root == NIL || parser.current != end) {
+        freeExprTree(ret);
+        return NULL;
+    }
+    ret->size = ret->used;
+    ret->nodes = realloc(ret->nodes, sizeof(struct node) * ret->size);
+    return ret;
+}
+
+// One formula per line, empty lines are skipped.
+ExprTree **parseExprTrees(const char *buffer, size_t size, size_t *count) {
+    size_t lines = 1;
+    for (const char *c = memchr(buffer, '\n', size); c; c = memchr(c + 1, '\n', buffer + size - c - 1))
+        lines++;
+    ExprTree **ret = malloc(sizeof(ExprTree*) * lines);
+    const char *end = buffer + size;
+    size_t line = 0;
+    *count = 0;
+    while (buffer < end) {
+        const char *lineEnd = memchr(buffer, '\n', end - buffer);
+        lineEnd = lineEnd ? lineEnd : end;
+        line++;
+        if (lineEnd != buffer) {
+            ExprTree *tree = parseExprTree(buffer, lineEnd);
+            if (tree)
+                ret[(*count)++] = tree;
+            else
+                printf("ERROR: unable to parse line %lu\n", line);
+        }
+        buffer = lineEnd + 1;
+    }
+    return ret;
+}
+
+unsigned int evalNode(ExprTree *tree, uint32_t index) {
+    struct node *node = &tree->nodes[index];
+    unsigned int *values = tree->values;
+    if (node->type == variableNode) {
+        if (!vars[node->value - 'a'].valid) {
+            printf("enter variable %c: ", node->value);
+            scanf("%d", &(vars[node->value - 'a'].value));
+            vars[node->value - 'a'].valid = 1;
+        }
+        return vars[node->value - 'a'].value;
+    }
+    if (node->type == valueNode)
+        return node->value;
     switch (node->value) {
         case '^':
-            return evalNode(node->left) ^ evalNode(node->right);
+            return values[node->left] ^ values[node->right];
             break;
         case '|':
-            return evalNode(node->left) | evalNode(node->right);
+            return values[node->left] | values[node->right];
             break;
         case '&':
-            return evalNode(node->left) & evalNode(node->right);
+            return values[node->left] & values[node->right];
             break;
         case '~': {
-            if (!node->left)
-                return ~evalNode(node->right);
-            if (!node->right)
-                return ~evalNode(node->left);
+            if (node->left == NIL)
+                return ~values[node->right];
+            if (node->right == NIL)
+                return ~values[node->left];
             break;
         }
         default:
@@ -129,15 +359,412 @@ unsigned int evalNode(struct node *node) {
 }
 
 unsigned int evalTree(ExprTree *tree) {
-    return evalNode(tree->root);
+    if (tree->valuesSize < tree->used) {
+        tree->valuesSize = tree->used;
+        tree->values = realloc(tree->values, sizeof(unsigned int) * tree->valuesSize);
+    }
+    for (uint32_t i = 0; i < tree->used; i++)
+        tree->values[i] = evalNode(tree, i);
+    return tree->values[tree->root];
+}
+
+// Bit-sliced counterpart of evalNode: every variable is a block holding one boolean per
+// assignment, constants contribute bit `plane` of their value.
+block evalNodeSliced(ExprTree *tree, uint32_t index, const block *values, const block *inputs, unsigned int plane) {
+    struct node *node = &tree->nodes[index];
+    block zero = {0};
+    if (node->type == variableNode)
+        return inputs[node->value - 'a'];
+    if (node->type == valueNode)
+        return ((node->value >> plane) & 1) ? ~zero : zero;
+    switch (node->value) {
+        case '^':
+            return values[node->left] ^ values[node->right];
+            break;
+        case '|':
+            return values[node->left] | values[node->right];
+            break;
+        case '&':
+            return values[node->left] & values[node->right];
+            break;
+        case '~': {
+            if (node->left == NIL)
+                return ~values[node->right];
+            if (node->right == NIL)
+                return ~values[node->left];
+            break;
+        }
+        default:
+            break;
+    }
+    return zero;
+}
+
+// Stores the names of the variables used by the tree in alphabetical order, returns their count.
+unsigned int collectVars(ExprTree *tree, char *names) {
+    unsigned int used = 0;
+    for (uint32_t i = 0; i < tree->used; i++) {
+        struct node *node = &tree->nodes[i];
+        if (node->type == variableNode)
+            used |= 1u << (node->value - 'a');
+    }
+    unsigned int count = 0;
+    for (int i = 0; i < 26; i++)
+        if (used & (1u << i))
+            names[count++] = 'a' + i;
+    return count;
+}
+
+// Evaluates bit `plane` of the formula for all 2^count assignments of the variables in names.
+// Bit t of the result is the value for the assignment where names[j] = (t >> j) & 1.
+uint64_t *evalTruthTable(ExprTree *tree, const char *names, unsigned int count, unsigned int plane) {
+    static const uint64_t patterns[6] = {
+        0xaaaaaaaaaaaaaaaaull, 0xccccccccccccccccull, 0xf0f0f0f0f0f0f0f0ull,
+        0xff00ff00ff00ff00ull, 0xffff0000ffff0000ull, 0xffffffff00000000ull
+    };
+    size_t total = (size_t)1 << count;
+    size_t words = (total + 63) / 64;
+    size_t blocks = (total + BLOCK_BITS - 1) / BLOCK_BITS;
+    uint64_t *ret = malloc(sizeof(uint64_t) * words);
+    block *values = aligned_alloc(BLOCK_BYTES, sizeof(block) * tree->used);
+    block inputs[26];
+    for (size_t i = 0; i < blocks; i++) {
+        for (unsigned int j = 0; j < count; j++) {
+            block input;
+            for (unsigned int w = 0; w < BLOCK_WORDS; w++) {
+                size_t base = i * BLOCK_BITS + w * 64;
+                input[w] = (j < 6) ? patterns[j] : (((base >> j) & 1) ? ~0ull : 0);
+            }
+            inputs[names[j] - 'a'] = input;
+        }
+        for (uint32_t k = 0; k < tree->used; k++)
+            values[k] = evalNodeSliced(tree, k, values, inputs, plane);
+        size_t first = i * BLOCK_WORDS;
+        size_t last = (first + BLOCK_WORDS < words) ? first + BLOCK_WORDS : words;
+        for (size_t w = first; w < last; w++)
+            ret[w] = values[tree->root][w - first];
+    }
+    if (total < 64)
+        ret[0] &= (1ull << total) - 1;
+    free(values);
+    return ret;
+}
+
+void printTruthTable(ExprTree *tree) {
+    char names[26];
+    unsigned int count = collectVars(tree, names);
+    uint64_t *table = evalTruthTable(tree, names, count, 0);
+    size_t total = (size_t)1 << count;
+    size_t satisfying = 0;
+    for (size_t i = 0; i < (total + 63) / 64; i++)
+        satisfying += __builtin_popcountll(table[i]);
+    if (count <= 5) {
+        for (unsigned int j = 0; j < count; j++)
+            printf("%c ", names[j]);
+        puts("| result");
+        for (size_t t = 0; t < total; t++) {
+            for (unsigned int j = 0; j < count; j++)
+                printf("%lu ", (t >> j) & 1);
+            printf("| %lu\n", (table[t / 64] >> (t % 64)) & 1);
+        }
+    }
+    printf("satisfying assignments: %lu of %lu\n", satisfying, total);
+    free(table);
+}
+
+// Asks for every unbound variable in the order evalTree would.
+void bindVars(ExprTree *tree) {
+    for (uint32_t i = 0; i < tree->used; i++) {
+        struct node *node = &tree->nodes[i];
+        if (node->type == variableNode)
+            evalNode(tree, i);
+    }
 }
 
+static inline void emitByte(struct emitter *emitter, unsigned char byte) {
+    emitter->code[emitter->used++] = byte;
+}
+
+static inline void emitBytes(struct emitter *emitter, const void *bytes, size_t size) {
+    memcpy(emitter->code + emitter->used, bytes, size);
+    emitter->used += size;
+}
+
+// [REX] <opcode> with a register to register ModRM, 32-bit operands
+static void emitRegOp(struct emitter *emitter, unsigned char opcode, unsigned int reg, unsigned int rm) {
+    if (reg >= 8 || rm >= 8)
+        emitByte(emitter, 0x40 | ((reg >= 8) << 2) | (rm >= 8));
+    emitByte(emitter, opcode);
+    emitByte(emitter, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// mov r32, [rdi + disp32]
+static void emitLoadVar(struct emitter *emitter, unsigned int reg, int var) {
+    int32_t disp = (var - 'a') * sizeof(struct vars);
+    if (reg >= 8)
+        emitByte(emitter, 0x44);
+    emitByte(emitter, 0x8b);
+    emitByte(emitter, 0x80 | ((reg & 7) << 3) | 7);
+    emitBytes(emitter, &disp, sizeof(disp));
+}
+
+// mov r32, imm32
+static void emitLoadConst(struct emitter *emitter, unsigned int reg, int value) {
+    if (reg >= 8)
+        emitByte(emitter, 0x41);
+    emitByte(emitter, 0xb8 | (reg & 7));
+    emitBytes(emitter, &value, sizeof(value));
+}
+
+static int gprOpcode(int op) {
+    switch (op) {
+        case '^':
+            return 0x31;
+        case '|':
+            return 0x09;
+        case '&':
+            return 0x21;
+        default:
+            return 0;
+    }
+}
+
+// Compiles the tree to a function taking the vars array. Registers are assigned
+// Sethi-Ullman style, the heavier operand is evaluated first. Returns NULL when the
+// target is not x86-64, the tree needs more than JIT_REGISTERS registers or holds
+// an unknown operator; the caller falls back to evalTree then.
+CompiledExpr *compileExprTree(ExprTree *tree) {
+#ifndef __x86_64__
+    return NULL;
+#else
+    uint32_t *need = malloc(sizeof(uint32_t) * tree->used);
+    for (uint32_t i = 0; i < tree->used; i++) {
+        struct node *node = &tree->nodes[i];
+        if (node->type != opNode) {
+            need[i] = 1;
+        } else if (node->left == NIL || node->right == NIL) {
+            if (node->value != '~') {
+                free(need);
+                return NULL;
+            }
+            need[i] = need[node->left == NIL ? node->right : node->left];
+        } else if (!gprOpcode(node->value)) {
+            free(need);
+            return NULL;
+        } else {
+            uint32_t left = need[node->left];
+            uint32_t right = need[node->right];
+            need[i] = (left == right) ? left + 1 : (left > right ? left : right);
+        }
+    }
+    if (need[tree->root] > JIT_REGISTERS) {
+        free(need);
+        return NULL;
+    }
+    size_t size = (tree->used * 8 + 16 + 4095) & ~(size_t)4095;
+    unsigned char *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(need);
+        return NULL;
+    }
+    struct emitter emitter = {code, 0};
+    struct jitFrame *stack = malloc(sizeof(struct jitFrame) * tree->used);
+    size_t top = 0;
+    stack[top++] = (struct jitFrame){tree->root, 0, 0};
+    while (top) {
+        struct jitFrame *frame = &stack[top - 1];
+        struct node *node = &tree->nodes[frame->node];
+        unsigned int reg = jitRegisters[frame->reg];
+        if (node->type == variableNode) {
+            emitLoadVar(&emitter, reg, node->value);
+            top--;
+        } else if (node->type == valueNode) {
+            emitLoadConst(&emitter, reg, node->value);
+            top--;
+        } else if (node->left == NIL || node->right == NIL) {
+            if (frame->state++ == 0) {
+                stack[top++] = (struct jitFrame){node->left == NIL ? node->right : node->left, frame->reg, 0};
+            } else {
+                emitRegOp(&emitter, 0xf7, 2, reg);
+                top--;
+            }
+        } else {
+            int rightFirst = need[node->right] > need[node->left];
+            if (frame->state == 0) {
+                frame->state = 1;
+                stack[top++] = (struct jitFrame){rightFirst ? node->right : node->left, frame->reg, 0};
+            } else if (frame->state == 1) {
+                frame->state = 2;
+                stack[top++] = (struct jitFrame){rightFirst ? node->left : node->right, frame->reg + 1, 0};
+            } else {
+                emitRegOp(&emitter, gprOpcode(node->value), jitRegisters[frame->reg + 1], reg);
+                top--;
+            }
+        }
+    }
+    emitByte(&emitter, 0xc3);
+    free(stack);
+    free(need);
+    mprotect(code, size, PROT_READ | PROT_EXEC);
+    CompiledExpr *ret = malloc(sizeof(CompiledExpr));
+    ret->function = (unsigned int (*)(const struct vars*))code;
+    ret->size = size;
+    return ret;
+#endif
+}
+
+void freeCompiledExpr(CompiledExpr *compiled) {
+    munmap((void*)compiled->function, compiled->size);
+    free(compiled);
+}
+
+unsigned int evalTreeJit(ExprTree *tree) {
+    CompiledExpr *compiled = compileExprTree(tree);
+    if (!compiled)
+        return evalTree(tree);
+    bindVars(tree);
+    unsigned int ret = compiled->function(vars);
+    freeCompiledExpr(compiled);
+    return ret;
+}
+
+char *readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *ret = malloc(*size + 1);
+    *size = fread(ret, 1, *size, file);
+    ret[*size] = 0;
+    fclose(file);
+    return ret;
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+void benchmarkParser(const char *buffer, size_t size) {
+    size_t passes = 0;
+    size_t count = 0;
+    double start = now();
+    double elapsed;
+    do {
+        ExprTree **trees = parseExprTrees(buffer, size, &count);
+        for (size_t i = 0; i < count; i++)
+            freeExprTree(trees[i]);
+        free(trees);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    printf("parsed %lu formulas (%lu bytes) %lu times in %lf s: %lf MB/s\n",
+           count, size, passes, elapsed, size * passes / elapsed / 1e6);
+}
+
+// Keeps the benchmark loops from being optimized away.
+volatile unsigned int sink;
+
+// Same variable values for every formula so that nothing is read from stdin.
+void benchmarkEval(const char *buffer, size_t size) {
+    for (int i = 0; i < 26; i++) {
+        vars[i].value = 0x9e3779b9u * (i + 1);
+        vars[i].valid = 1;
+    }
+    size_t count;
+    ExprTree **trees = parseExprTrees(buffer, size, &count);
+    CompiledExpr **compiled = malloc(sizeof(CompiledExpr*) * (count ? count : 1));
+    size_t nodes = 0;
+    size_t fallbacks = 0;
+    double start = now();
+    for (size_t i = 0; i < count; i++) {
+        nodes += trees[i]->used;
+        compiled[i] = compileExprTree(trees[i]);
+        fallbacks += !compiled[i];
+    }
+    double compileTime = now() - start;
+    size_t passes = 0;
+    start = now();
+    double elapsed;
+    do {
+        for (size_t i = 0; i < count; i++)
+            sink = evalTree(trees[i]);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    double interpreterTime = elapsed / passes;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i++)
+        if (compiled[i] && compiled[i]->function(vars) != evalTree(trees[i]))
+            mismatches++;
+    passes = 0;
+    start = now();
+    do {
+        for (size_t i = 0; i < count; i++)
+            sink = compiled[i] ? compiled[i]->function(vars) : evalTree(trees[i]);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < 1.0);
+    double jitTime = elapsed / passes;
+    printf("%lu formulas, %lu nodes, %lu interpreted fallbacks, compiled in %lf s\n", count, nodes, fallbacks, compileTime);
+    printf("interpreter: %lf ns/node\n", interpreterTime / nodes * 1e9);
+    printf("jit: %lf ns/node (%lfx), %lu mismatches\n", jitTime / nodes * 1e9, interpreterTime / jitTime, mismatches);
+    for (size_t i = 0; i < count; i++) {
+        if (compiled[i])
+            freeCompiledExpr(compiled[i]);
+        freeExprTree(trees[i]);
+    }
+    free(compiled);
+    free(trees);
+}
+
+// usage: t2_1_5 [-b|-e|-j|-t] [file]
+//   without a file uses the built-in test tree,
+//   otherwise evaluates every formula in file (one per line),
+//   -j evaluates through the JIT when the formula can be compiled,
+//   -b measures parse throughput instead,
+//   -e compares interpreter and JIT evaluation speed,
+//   -t prints the truth table of the lowest bit over all variable assignments
 int main(int argc, char **argv) {
     memset(vars, 0, sizeof(struct vars) * 26);
-    ExprTree *tree = makeTestTree();
-    unsigned int result = evalTree(tree);
-    printf("result: %d\n", result);
-    freeExprTree(tree);
+    int truthTable = argc > 1 && !strcmp(argv[1], "-t");
+    int jit = argc > 1 && !strcmp(argv[1], "-j");
+    if (argc == 1 + truthTable + jit) {
+        ExprTree *tree = makeTestTree();
+        if (truthTable) {
+            printTruthTable(tree);
+        } else {
+            unsigned int result = jit ? evalTreeJit(tree) : evalTree(tree);
+            printf("result: %d\n", result);
+        }
+        freeExprTree(tree);
+        return 0;
+    }
+    size_t size;
+    char *buffer = readFile(argv[argc - 1], &size);
+    if (!buffer) {
+        printf("ERROR: unable to read %s\n", argv[argc - 1]);
+        return 1;
+    }
+    if (argc == 3 && !strcmp(argv[1], "-b")) {
+        benchmarkParser(buffer, size);
+    } else if (argc == 3 && !strcmp(argv[1], "-e")) {
+        benchmarkEval(buffer, size);
+    } else {
+        size_t count;
+        ExprTree **trees = parseExprTrees(buffer, size, &count);
+        for (size_t i = 0; i < count; i++) {
+            if (truthTable)
+                printTruthTable(trees[i]);
+            else
+                printf("result: %d\n", jit ? evalTreeJit(trees[i]) : evalTree(trees[i]));
+            freeExprTree(trees[i]);
+        }
+        free(trees);
+    }
+    free(buffer);
     return 0;
 }
-
@@ -14,165 +14,394 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
 
+#include "output.h"
+
+// Without -fopenmp the pragmas vanish and the parallel paths run serially.
+#ifdef _OPENMP
+#define PRAGMA(x) _Pragma(#x)
+#else
+#define PRAGMA(x)
+#endif
+
+// Subtrees rooted above TASK_DEPTH are split into tasks, deeper ones are walked serially.
+// Rendering also keeps subtrees smaller than RENDER_CUTOFF nodes in the current task.
+#define TASK_DEPTH 6
+#define RENDER_CUTOFF 4096
+
+#define NIL UINT32_MAX
+
+// Nodes live in one array in creation order, so a parent always precedes its children.
+// The children of a node are children[first .. first + degree), in the order they were added.
 struct node {
-    struct node** nodes;
     char* string;
+    uint32_t parent;
+    uint32_t first;
+    uint32_t degree;
 };
 
 typedef struct {
-    struct node* root;
+    struct node* nodes;
+    uint32_t* children;
+    uint32_t used;
+    uint32_t size;
+    // filled by measureTree
+    size_t* counts;
+    uint32_t* heights;
+    size_t* bytes;  // rendered size of the subtree when its root is printed at height 0
 } Tree;
 
-struct printTreeStruct {
-    char** padding;
-    char** value;
-    size_t nodesCount;
-    size_t treeHeight;
+// Explicit traversal stack, trees may be far deeper than the call stack allows.
+struct frame {
+    uint32_t node;
+    uint32_t height;
+    uint32_t counter;
 };
 
+typedef struct {
+    struct frame* frames;
+    size_t used;
+    size_t size;
+} Stack;
+
 Tree* newTree();
 void freeTree(Tree*);
-void printTreeStruct(struct printTreeStruct*);
-size_t subtreeNodesCount(struct node*);
+uint32_t addNode(Tree*, char*, uint32_t);
+void linkTree(Tree*);
+void printTree(Tree*, Output*);
+size_t subtreeNodesCount(Tree*, uint32_t);
 size_t getNodesCount(Tree*);
-size_t subtreeHeight(struct node*);
+size_t subtreeHeight(Tree*, uint32_t);
 size_t getTreeHeight(Tree*);
-void printTreeStruct(struct printTreeStruct*);
-void freeTreePrintStruct(struct printTreeStruct*);
-void fill(Tree* tree, struct printTreeStruct*);
-struct node *newNode(char*, size_t);
-
-struct node *newNode(char *value, size_t size) {
-    size++;
-    struct node *ret = (struct node*)malloc(sizeof(struct node));
-    ret->nodes = (struct node**)malloc(sizeof(struct node*) * size);
-    for (size_t i = 0; i < size; i++)
-        ret->nodes[i] = NULL;
-    ret->string = value;
-    return ret;
-}
+void push(Stack*, uint32_t, uint32_t);
+void measureTree(Tree*);
+void printTreeParallel(Tree*, Output*);
 
 Tree* newTree() {
     Tree* ret = (Tree*)malloc(sizeof(Tree));
-    ret->root = NULL;
+    ret->size = 64;
+    ret->used = 0;
+    ret->nodes = (struct node*)malloc(sizeof(struct node) * ret->size);
+    ret->children = NULL;
+    ret->counts = NULL;
+    ret->heights = NULL;
+    ret->bytes = NULL;
     return ret;
 }
 
-void makeTestTree(Tree* tree) {
-    struct node* root = tree->root = newNode("A", 2);
-    struct node* nodeB = root->nodes[0] = newNode("B", 2);
-    struct node* nodeC = nodeB->nodes[0] = newNode("C", 1);
-    nodeC->nodes[0] = newNode("D", 0);
-    nodeB->nodes[1] = newNode("E", 0);
-    struct node* nodeF = root->nodes[1] = newNode("F", 1);
-    nodeF->nodes[0] = newNode("H", 0);
+void freeTree(Tree* tree) {
+    free(tree->nodes);
+    free(tree->children);
+    free(tree->counts);
+    free(tree->heights);
+    free(tree->bytes);
+    free(tree);
 }
 
-void _freeTree(struct node* node) {
-    size_t counter = 0;
-    while (node->nodes[counter]) {
-        _freeTree(node->nodes[counter]);
-        counter++;
+// The first node added is the root and takes NIL as its parent.
+uint32_t addNode(Tree* tree, char* value, uint32_t parent) {
+    if (tree->used == tree->size) {
+        tree->size *= 2;
+        tree->nodes = (struct node*)realloc(tree->nodes, sizeof(struct node) * tree->size);
     }
-    free(node->nodes);
-    free(node);
+    struct node* node = &tree->nodes[tree->used];
+    node->string = value;
+    node->parent = parent;
+    node->first = 0;
+    node->degree = 0;
+    return tree->used++;
 }
 
-void freeTree(Tree* tree) {
-    _freeTree(tree->root);
-    free(tree);
+// Builds the child-index array with a counting sort on the parent, which keeps siblings
+// in the order they were added. Has to run after the last addNode.
+void linkTree(Tree* tree) {
+    struct node* nodes = tree->nodes;
+    for (uint32_t i = 1; i < tree->used; i++)
+        nodes[nodes[i].parent].degree++;
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < tree->used; i++) {
+        nodes[i].first = first;
+        first += nodes[i].degree;
+        nodes[i].degree = 0;
+    }
+    tree->children = (uint32_t*)realloc(tree->children, sizeof(uint32_t) * (first ? first : 1));
+    for (uint32_t i = 1; i < tree->used; i++) {
+        struct node* parent = &nodes[nodes[i].parent];
+        tree->children[parent->first + parent->degree++] = i;
+    }
+}
+
+void push(Stack* stack, uint32_t node, uint32_t height) {
+    if (stack->used == stack->size) {
+        stack->size = stack->size ? stack->size * 2 : 64;
+        stack->frames = (struct frame*)realloc(stack->frames, sizeof(struct frame) * stack->size);
+    }
+    struct frame* frame = &stack->frames[stack->used++];
+    frame->node = node;
+    frame->height = height;
+    frame->counter = 0;
 }
 
-size_t subtreeNodesCount(struct node* node) {
-    size_t ret = 1;
-    size_t counter = 0;
-    while (node->nodes[counter]) {
-        ret += subtreeNodesCount(node->nodes[counter]);
-        counter += 1;
+void makeTestTree(Tree* tree) {
+    uint32_t root = addNode(tree, "A", NIL);
+    uint32_t nodeB = addNode(tree, "B", root);
+    uint32_t nodeC = addNode(tree, "C", nodeB);
+    addNode(tree, "D", nodeC);
+    addNode(tree, "E", nodeB);
+    uint32_t nodeF = addNode(tree, "F", root);
+    addNode(tree, "H", nodeF);
+    linkTree(tree);
+}
+
+size_t subtreeNodesCount(Tree* tree, uint32_t node) {
+    size_t ret = 0;
+    Stack stack = {NULL, 0, 0};
+    push(&stack, node, 0);
+    while (stack.used) {
+        struct node* current = &tree->nodes[stack.frames[--stack.used].node];
+        for (uint32_t i = 0; i < current->degree; i++)
+            push(&stack, tree->children[current->first + i], 0);
+        ret++;
     }
+    free(stack.frames);
     return ret;
 }
 
 size_t getNodesCount(Tree* tree) {
-    return subtreeNodesCount(tree->root);
+    return tree->used;
 }
 
-size_t subtreeHeight(struct node* node) {
-    size_t ret = 1;
-    size_t counter = 0;
-    size_t maxSubtreeHeight = 0;
-    while (node->nodes[counter]) {
-        size_t temp = subtreeHeight(node->nodes[counter]);
-        maxSubtreeHeight = (temp > maxSubtreeHeight) ? temp : maxSubtreeHeight;
-        counter++;
+size_t subtreeHeight(Tree* tree, uint32_t node) {
+    size_t ret = 0;
+    Stack stack = {NULL, 0, 0};
+    push(&stack, node, 1);
+    while (stack.used) {
+        struct frame frame = stack.frames[--stack.used];
+        struct node* current = &tree->nodes[frame.node];
+        ret = (frame.height > ret) ? frame.height : ret;
+        for (uint32_t i = 0; i < current->degree; i++)
+            push(&stack, tree->children[current->first + i], frame.height + 1);
     }
-    ret += maxSubtreeHeight;
+    free(stack.frames);
     return ret;
 }
 
 size_t getTreeHeight(Tree* tree) {
-    return subtreeHeight(tree->root);
+    return subtreeHeight(tree, 0);
 }
 
-void printTreeStruct(struct printTreeStruct* printTreeStruct) {
-    printf("%s\n", printTreeStruct->value[0]);
-    for (size_t i = 1; i < printTreeStruct->nodesCount; i++) {
-        printf("%s", printTreeStruct->padding[i - 1]);
-        printf("%s\n", printTreeStruct->value[i]);
+// Writes the tree depth first in a single pass. prefix holds the "| " or "  " columns
+// of the current node's ancestors, so working memory is proportional to the height.
+void printTree(Tree* tree, Output* out) {
+    Stack stack = {NULL, 0, 0};
+    size_t prefixSize = 64;
+    char* prefix = (char*)malloc(prefixSize);
+    outputString(out, tree->nodes[0].string);
+    outputChar(out, '\n');
+    push(&stack, 0, 0);
+    while (stack.used) {
+        struct frame* frame = &stack.frames[stack.used - 1];
+        struct node* node = &tree->nodes[frame->node];
+        if (frame->counter == node->degree) {
+            stack.used--;
+            continue;
+        }
+        uint32_t child = tree->children[node->first + frame->counter];
+        size_t height = frame->height;
+        int last = ++frame->counter == node->degree;
+        outputBytes(out, prefix, height * 2);
+        outputBytes(out, last ? "\\-" : "+-", 2);
+        outputString(out, tree->nodes[child].string);
+        outputChar(out, '\n');
+        if (height * 2 + 2 > prefixSize) {
+            prefixSize *= 2;
+            prefix = (char*)realloc(prefix, prefixSize);
+        }
+        memcpy(prefix + height * 2, last ? "  " : "| ", 2);
+        push(&stack, child, height + 1);
     }
+    free(prefix);
+    free(stack.frames);
 }
 
-struct printTreeStruct* initPrint(Tree* tree) {
-    struct printTreeStruct* ret = (struct printTreeStruct*)malloc(sizeof(struct printTreeStruct));
-    ret->nodesCount = getNodesCount(tree);
-    ret->treeHeight = getTreeHeight(tree);
-    ret->value = (char**)malloc(sizeof(char*) * ret->nodesCount);
-    ret->padding = (char**)malloc(sizeof(char*) * ret->nodesCount);
-    for (size_t i = 0; i < ret->nodesCount; i++) {
-        ret->padding[i] = (char*)malloc(sizeof(char) * 2 * ret->treeHeight + 1);
-        memset(ret->padding[i], ' ', ret->treeHeight * 2);
+// Fills counts, heights and bytes of every node in one reverse scan: children come after
+// their parent, so each subtree is complete by the time it is added to the parent.
+// A child printed one level lower than its parent takes two more bytes per line.
+void measureTree(Tree* tree) {
+    size_t used = tree->used;
+    tree->counts = (size_t*)realloc(tree->counts, sizeof(size_t) * used);
+    tree->heights = (uint32_t*)realloc(tree->heights, sizeof(uint32_t) * used);
+    tree->bytes = (size_t*)realloc(tree->bytes, sizeof(size_t) * used);
+    for (size_t i = 0; i < used; i++) {
+        tree->counts[i] = 1;
+        tree->heights[i] = 1;
+        tree->bytes[i] = strlen(tree->nodes[i].string) + 1;
     }
-    return ret;
+    for (size_t i = used - 1; i > 0; i--) {
+        uint32_t parent = tree->nodes[i].parent;
+        tree->counts[parent] += tree->counts[i];
+        if (tree->heights[i] + 1 > tree->heights[parent])
+            tree->heights[parent] = tree->heights[i] + 1;
+        tree->bytes[parent] += tree->bytes[i] + 2 * tree->counts[i];
+    }
+}
+
+// prefix holds the 2 * (height - 1) column bytes of the node's ancestors.
+static char* renderLine(char* cursor, const char* prefix, size_t height, int last, const char* string) {
+    if (height) {
+        memcpy(cursor, prefix, height * 2 - 2);
+        cursor += height * 2 - 2;
+        memcpy(cursor, last ? "\\-" : "+-", 2);
+        cursor += 2;
+    }
+    size_t length = strlen(string);
+    memcpy(cursor, string, length);
+    cursor[length] = '\n';
+    return cursor + length + 1;
 }
 
-void freeTreePrintStruct(struct printTreeStruct* ret) {
-    for (size_t i = 0; i < ret->nodesCount; i++)
-        free(ret->padding[i]);
-    free(ret->padding);
-    free(ret->value);
-    free(ret);
-}
-
-void _fill(struct node* node, struct printTreeStruct* printTreeStruct, size_t height, size_t row) {
-    size_t counter = 0;
-    printTreeStruct->value[row] = node->string;
-    while (node->nodes[counter]) {
-        size_t nodesCount = subtreeNodesCount(node->nodes[counter]);
-        if (node->nodes[counter + 1]) {
-            sprintf(printTreeStruct->padding[row] + height * 2, "+-");
-            for (size_t i = row + 1; i < row + nodesCount; i++)
-                sprintf(printTreeStruct->padding[i] + height * 2, "| ");
-        } else {
-            sprintf(printTreeStruct->padding[row] + height * 2, "\\-");
+// Same walk as printTree, writing into memory below a node printed at the given height.
+static void renderSerial(Tree* tree, uint32_t index, size_t height, const char* parentPrefix, int last, char* cursor) {
+    Stack stack = {NULL, 0, 0};
+    char* prefix = (char*)malloc(2 * (height + tree->heights[index]) + 2);
+    cursor = renderLine(cursor, parentPrefix, height, last, tree->nodes[index].string);
+    if (height) {
+        memcpy(prefix, parentPrefix, height * 2 - 2);
+        memcpy(prefix + height * 2 - 2, last ? "  " : "| ", 2);
+    }
+    push(&stack, index, height);
+    while (stack.used) {
+        struct frame* frame = &stack.frames[stack.used - 1];
+        struct node* node = &tree->nodes[frame->node];
+        if (frame->counter == node->degree) {
+            stack.used--;
+            continue;
         }
-        _fill(node->nodes[counter], printTreeStruct, height + 1, row + 1);
-        row += nodesCount;
-        counter++;
+        uint32_t child = tree->children[node->first + frame->counter];
+        int childLast = ++frame->counter == node->degree;
+        size_t childHeight = frame->height + 1;
+        cursor = renderLine(cursor, prefix, childHeight, childLast, tree->nodes[child].string);
+        memcpy(prefix + childHeight * 2 - 2, childLast ? "  " : "| ", 2);
+        push(&stack, child, childHeight);
+    }
+    free(prefix);
+    free(stack.frames);
+}
+
+// Every child starts right after the bytes of its previous siblings, so large children
+// are rendered as independent tasks straight into their final place.
+static void renderNode(Tree* tree, uint32_t index, size_t height, const char* prefix, int last, char* cursor) {
+    if (height >= TASK_DEPTH || tree->counts[index] < RENDER_CUTOFF) {
+        renderSerial(tree, index, height, prefix, last, cursor);
+        return;
+    }
+    struct node* node = &tree->nodes[index];
+    cursor = renderLine(cursor, prefix, height, last, node->string);
+    char* childPrefix = (char*)malloc(height * 2 + 2);
+    if (height) {
+        memcpy(childPrefix, prefix, height * 2 - 2);
+        memcpy(childPrefix + height * 2 - 2, last ? "  " : "| ", 2);
+    }
+    for (uint32_t i = 0; i < node->degree; i++) {
+        uint32_t child = tree->children[node->first + i];
+        int childLast = i + 1 == node->degree;
+        PRAGMA(omp task)
+        renderNode(tree, child, height + 1, childPrefix, childLast, cursor);
+        cursor += tree->bytes[child] + 2 * (height + 1) * tree->counts[child];
+    }
+    PRAGMA(omp taskwait)
+    free(childPrefix);
+}
+
+// Produces the same text as printTree. The whole dump is built in memory first,
+// which trades O(height) working memory for rendering on every core. Dumps too large
+// for memory go through the streaming printer.
+void printTreeParallel(Tree* tree, Output* out) {
+    measureTree(tree);
+    size_t size = tree->bytes[0];
+    char* buffer = (char*)malloc(size);
+    if (!buffer) {
+        printTree(tree, out);
+        return;
+    }
+    PRAGMA(omp parallel)
+    PRAGMA(omp single)
+    renderNode(tree, 0, 0, "", 1, buffer);
+    outputBytes(out, buffer, size);
+    free(buffer);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Builds a complete tree where every inner node has fanout children, level by level.
+void makeCompleteTree(Tree* tree, size_t fanout, size_t depth) {
+    uint32_t levelBegin = 0, levelEnd = 1;
+    addNode(tree, "node", NIL);
+    for (size_t height = 1; height < depth; height++) {
+        for (uint32_t parent = levelBegin; parent < levelEnd; parent++)
+            for (size_t i = 0; i < fanout; i++)
+                addNode(tree, "node", parent);
+        levelBegin = levelEnd;
+        levelEnd = tree->used;
     }
+    linkTree(tree);
 }
 
-void fill(Tree* tree, struct printTreeStruct* printTreeStruct) {
-    _fill(tree->root, printTreeStruct, 0, 0);
+// Renders a complete tree into /dev/null with both printers.
+void benchmarkPrint(size_t fanout, size_t depth) {
+    Tree* tree = newTree();
+    makeCompleteTree(tree, fanout, depth);
+    int fd = open("/dev/null", O_WRONLY);
+    Output* out = newOutput(fd);
+    double start = now();
+    printTree(tree, out);
+    flushOutput(out);
+    double serial = now() - start;
+    start = now();
+    printTreeParallel(tree, out);
+    flushOutput(out);
+    double parallel = now() - start;
+    freeOutput(out);
+    close(fd);
+    printf("nodes: %lu; height: %u; bytes: %lu;\n", tree->counts[0], tree->heights[0], tree->bytes[0]);
+    printf("serial: %.3f s; parallel: %.3f s; speedup: %.2f\n", serial, parallel, serial / parallel);
+    freeTree(tree);
+}
+
+// Builds a single path of depth nodes.
+void makeChainTree(Tree* tree, size_t depth) {
+    addNode(tree, "x", NIL);
+    for (size_t i = 1; i < depth; i++)
+        addNode(tree, "x", i - 1);
+    linkTree(tree);
 }
 
+// usage: t2_4_2 [-s <depth> | -p <fanout> <depth>]
+//   -s counts, measures and frees a chain of depth nodes instead of printing the example
+//   -p times the serial and parallel printers on a complete tree
 int main(int argc, char** argv) {
+    if (argc == 4 && !strcmp(argv[1], "-p")) {
+        benchmarkPrint(atol(argv[2]), atol(argv[3]));
+        return 0;
+    }
     Tree* tree = newTree();
+    if (argc == 3 && !strcmp(argv[1], "-s")) {
+        makeChainTree(tree, atol(argv[2]));
+        printf("nodes: %lu; height: %lu;\n", getNodesCount(tree), getTreeHeight(tree));
+        freeTree(tree);
+        return 0;
+    }
+    Output* out = newOutput(STDOUT_FILENO);
     makeTestTree(tree);
-    struct printTreeStruct* exampleTreePrintStruct = initPrint(tree);
-    fill(tree, exampleTreePrintStruct);
-    printTreeStruct(exampleTreePrintStruct);
-    freeTreePrintStruct(exampleTreePrintStruct);
+    printTree(tree, out);
+    freeOutput(out);
     freeTree(tree);
     return 0;
 }
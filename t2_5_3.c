@@ -3,109 +3,209 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "output.h"
 
 #define CMP <
 
+// Child links and the root are read by lock-free readers, so the writer publishes them atomically.
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, value) __atomic_store_n(&(x), (value), __ATOMIC_RELEASE)
+
+// No search path is longer than the height of a red-black tree, 2 * log2(n + 1).
+#define MAX_STEPS 128
+
 struct node {
     struct node* prev;
     struct node* left;
     struct node* right;
     char* string;
     int color;
+    unsigned int size;  // nodes in this subtree, fits the padding after color
 };
 
 enum {black = 0, red = 1};
 
+// One writer at a time, serialized by writer. sequence is odd while an add rewires links,
+// readers in contains check it to tell a real miss from one caused by a rotation.
 typedef struct {
     struct node* root;
+    unsigned long sequence;
+    pthread_mutex_t writer;
 } RBTree;
 
+// Every key that can reach a slot lies between the keys of two of its ancestors, so it
+// shares their common prefix with the slot's own key. The slot keeps that length and the
+// next 8 key bytes, most comparisons are decided there without touching the key itself.
+struct slot {
+    uint64_t head;      // big-endian, zero padded past the end of the key
+    uint32_t prefix;
+};
+
+// Read-only copy of the keys without pointers between entries, laid out in Eytzinger
+// (breadth first) order: the children of slot i are 2i and 2i + 1, slot 0 is unused.
+// keys[i] is the full key of slot i, the strings are copied into one block.
+typedef struct {
+    struct slot* slots;
+    char** keys;
+    char* strings;
+    size_t count;
+} FrozenTree;
+
 RBTree* newRBTree();
 void find(RBTree*, char*);
 void rotateLeft(RBTree*, struct node*);
 void rotateRight(RBTree*, struct node*);
 void add(RBTree*, char*);
+int contains(RBTree*, const char*, unsigned long*);
 void freeTree(RBTree*);
 void printTree(RBTree*);
+size_t rank(RBTree*, char*);
+char* selectKey(RBTree*, size_t);
+FrozenTree* freezeTree(RBTree*);
+int frozenContains(FrozenTree*, const char*);
+void freeFrozenTree(FrozenTree*);
 
 RBTree* newRBTree() {
     RBTree* ret = (RBTree*)malloc(sizeof(RBTree));
     ret->root = NULL;
+    ret->sequence = 0;
+    pthread_mutex_init(&ret->writer, NULL);
     return ret;
 }
 
-void find(RBTree* tree, char* value) {
+// Three-way compare that skips the first *lcp bytes, known to be equal, and stores
+// the length of the common prefix back.
+static inline int compareFrom(const char* a, const char* b, size_t* lcp) {
+    size_t i = *lcp;
+    while (a[i] && a[i] == b[i])
+        i++;
+    *lcp = i;
+    return (unsigned char)a[i] - (unsigned char)b[i];
+}
+
+// Every key below a node lies between the last ancestors the descent turned left and
+// right at, so it shares at least the smaller of their prefixes with value.
+// Returns the matching node, or NULL with *parent and *left telling where value belongs.
+static struct node* lookup(RBTree* tree, const char* value, struct node** parent, int* left) {
     struct node* temp = tree->root;
+    size_t lcpLeft = 0, lcpRight = 0;
+    *parent = NULL;
     while (temp) {
-        if (!strcmp(value, temp->string)) {
-            printf("%c %s\n", (temp->color == red) ? 'R' : 'B', temp->string);
-            return;
+        size_t lcp = (lcpLeft < lcpRight) ? lcpLeft : lcpRight;
+        int cmp = compareFrom(value, temp->string, &lcp);
+        if (!cmp)
+            return temp;
+        *parent = temp;
+        *left = cmp CMP 0;
+        if (*left) {
+            lcpLeft = lcp;
+            temp = temp->left;
+        } else {
+            lcpRight = lcp;
+            temp = temp->right;
         }
-        temp = (strcmp(value, temp->string) CMP 0) ? temp->left : temp->right;
     }
-    printf("Not Found\n");
+    return NULL;
+}
+
+void find(RBTree* tree, char* value) {
+    struct node* parent;
+    int left;
+    struct node* temp = lookup(tree, value, &parent, &left);
+    if (temp)
+        printf("%c %s\n", (temp->color == red) ? 'R' : 'B', temp->string);
+    else
+        printf("Not Found\n");
+}
+
+static inline unsigned int size(struct node* node) {
+    return node ? node->size : 0;
 }
 
 void rotateLeft(RBTree* tree, struct node* node) {
     struct node* rightNode = node->right;
-    node->right = rightNode->left;
+    STORE(node->right, rightNode->left);
     if (rightNode->left)
         rightNode->left->prev = node;
     if (rightNode)
         rightNode->prev = node->prev;
     if (node->prev) {
         if (node == node->prev->left)
-            node->prev->left = rightNode;
+            STORE(node->prev->left, rightNode);
         else
-            node->prev->right = rightNode;
+            STORE(node->prev->right, rightNode);
     } else {
-        tree->root = rightNode;
+        STORE(tree->root, rightNode);
     }
-    rightNode->left = node;
+    STORE(rightNode->left, node);
     if (node)
         node->prev = rightNode;
+    rightNode->size = node->size;
+    node->size = size(node->left) + size(node->right) + 1;
 }
 
 void rotateRight(RBTree* tree, struct node* node) {
     struct node* leftNode = node->left;
-    node->left = leftNode->right;
+    STORE(node->left, leftNode->right);
     if (leftNode->right)
         leftNode->right->prev = node;
     if (leftNode)
         leftNode->prev = node->prev;
     if (node->prev) {
         if (node == node->prev->right)
-            node->prev->right = leftNode;
+            STORE(node->prev->right, leftNode);
         else
-            node->prev->left = leftNode;
+            STORE(node->prev->left, leftNode);
     } else {
-        tree->root = leftNode;
+        STORE(tree->root, leftNode);
     }
-    leftNode->right = node;
+    STORE(leftNode->right, node);
     if (node)
         node->prev = leftNode;
+    leftNode->size = node->size;
+    node->size = size(node->left) + size(node->right) + 1;
+}
+
+static inline void writeBegin(RBTree* tree) {
+    __atomic_store_n(&tree->sequence, tree->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
+static inline void writeEnd(RBTree* tree) {
+    __atomic_store_n(&tree->sequence, tree->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// The new node is filled in before the release store that links it, so readers never see
+// it half built. Only the rotations can hide keys from a reader, they run inside
+// writeBegin and writeEnd.
 void add(RBTree* tree, char* tempString) {
-    struct node* temp = tree->root;
-    struct node* prev = NULL;
-    while (temp) {
-        if (!strcmp(tempString, temp->string)) return;
-        prev = temp;
-        temp = (strcmp(tempString, temp->string) CMP 0) ? temp->left : temp->right;
+    struct node* prev;
+    int left;
+    pthread_mutex_lock(&tree->writer);
+    if (lookup(tree, tempString, &prev, &left)) {
+        pthread_mutex_unlock(&tree->writer);
+        return;
     }
     char* value = strdup(tempString);
     struct node* newNode = (struct node*)malloc(sizeof(struct node));
     newNode->left = newNode->right = NULL;
     newNode->prev = prev;
     newNode->string = value;
+    newNode->size = 1;
+    for (struct node* temp = prev; temp; temp = temp->prev)
+        temp->size++;
     if (newNode->prev) {
-        if (strcmp(value, (newNode->prev)->string) CMP 0)
-            newNode->prev->left = newNode;
-        else
-            newNode->prev->right = newNode;
-        
         newNode->color = red;
+        if (left)
+            STORE(newNode->prev->left, newNode);
+        else
+            STORE(newNode->prev->right, newNode);
+        writeBegin(tree);
         while (newNode->prev && newNode->prev->color == red && newNode->color == red && newNode->prev->prev) {
             struct node* prevNode = newNode->prev;
             struct node* prevPrevNode = prevNode->prev;
@@ -130,10 +230,172 @@ void add(RBTree* tree, char* tempString) {
                 }
             }
         }
+        writeEnd(tree);
     } else {
         newNode->color = black;
-        tree->root = newNode;
+        STORE(tree->root, newNode);
     }
+    pthread_mutex_unlock(&tree->writer);
+}
+
+// Can run on any thread while add does. Keys are never removed and a node keeps its
+// string, so a hit is always right. A miss may come from a search that crossed a rotation
+// and is only trusted if no add was rewiring links meanwhile, otherwise the search is
+// retried and counted in *retries. Compares whole keys: prefixes learned before a
+// rotation do not hold after it.
+int contains(RBTree* tree, const char* value, unsigned long* retries) {
+    while (1) {
+        unsigned long sequence = __atomic_load_n(&tree->sequence, __ATOMIC_ACQUIRE);
+        if (!(sequence & 1)) {
+            struct node* temp = LOAD(tree->root);
+            for (size_t steps = 0; temp && steps < MAX_STEPS; steps++) {
+                int cmp = strcmp(value, temp->string);
+                if (!cmp)
+                    return 1;
+                temp = (cmp CMP 0) ? LOAD(temp->left) : LOAD(temp->right);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (!temp && __atomic_load_n(&tree->sequence, __ATOMIC_RELAXED) == sequence)
+                return 0;
+        }
+        if (retries)
+            (*retries)++;
+    }
+}
+
+// Number of keys ordered before value.
+size_t rank(RBTree* tree, char* value) {
+    struct node* temp = tree->root;
+    size_t lcpLeft = 0, lcpRight = 0;
+    size_t ret = 0;
+    while (temp) {
+        size_t lcp = (lcpLeft < lcpRight) ? lcpLeft : lcpRight;
+        int cmp = compareFrom(value, temp->string, &lcp);
+        if (cmp && cmp CMP 0) {
+            lcpLeft = lcp;
+            temp = temp->left;
+            continue;
+        }
+        ret += size(temp->left);
+        if (!cmp)
+            break;
+        ret++;
+        lcpRight = lcp;
+        temp = temp->right;
+    }
+    return ret;
+}
+
+// The index-th key in order, counting from 0, or NULL past the end.
+char* selectKey(RBTree* tree, size_t index) {
+    struct node* temp = tree->root;
+    while (temp) {
+        size_t leftSize = size(temp->left);
+        if (index == leftSize)
+            return temp->string;
+        if (index < leftSize) {
+            temp = temp->left;
+        } else {
+            index -= leftSize + 1;
+            temp = temp->right;
+        }
+    }
+    return NULL;
+}
+
+// Places sorted[*next ...] at the in-order positions of the implicit subtree at index.
+static void layoutEytzinger(FrozenTree* frozen, char** sorted, size_t* next, size_t index) {
+    if (index > frozen->count)
+        return;
+    layoutEytzinger(frozen, sorted, next, 2 * index);
+    frozen->keys[index] = sorted[(*next)++];
+    layoutEytzinger(frozen, sorted, next, 2 * index + 1);
+}
+
+static inline uint64_t loadHead(const char* string, size_t offset, size_t length) {
+    uint64_t ret = 0;
+    if (offset + 8 <= length)
+        memcpy(&ret, string + offset, 8);
+    else if (offset < length)
+        memcpy(&ret, string + offset, length - offset);
+    return __builtin_bswap64(ret);
+}
+
+// lower and upper are the keys of the nearest ancestors on either side, NULL past the ends.
+static void fillSlots(FrozenTree* frozen, size_t index, const char* lower, const char* upper) {
+    if (index > frozen->count)
+        return;
+    char* key = frozen->keys[index];
+    size_t prefix = 0;
+    if (lower && upper)
+        compareFrom(lower, upper, &prefix);
+    frozen->slots[index].prefix = prefix;
+    frozen->slots[index].head = loadHead(key, prefix, strlen(key));
+    fillSlots(frozen, 2 * index, lower, key);
+    fillSlots(frozen, 2 * index + 1, key, upper);
+}
+
+FrozenTree* freezeTree(RBTree* tree) {
+    FrozenTree* ret = (FrozenTree*)malloc(sizeof(FrozenTree));
+    ret->count = size(tree->root);
+    char** sorted = (char**)malloc(sizeof(char*) * (ret->count + 1));
+    struct node* stack[MAX_STEPS];
+    size_t used = 0, count = 0, bytes = 0;
+    struct node* temp = tree->root;
+    while (temp || used) {
+        while (temp) {
+            stack[used++] = temp;
+            temp = temp->left;
+        }
+        temp = stack[--used];
+        sorted[count++] = temp->string;
+        bytes += strlen(temp->string) + 1;
+        temp = temp->right;
+    }
+    ret->keys = (char**)malloc(sizeof(char*) * (ret->count + 1));
+    ret->keys[0] = NULL;
+    size_t next = 0;
+    layoutEytzinger(ret, sorted, &next, 1);
+    ret->strings = (char*)malloc(bytes ? bytes : 1);
+    char* cursor = ret->strings;
+    for (size_t i = 1; i <= ret->count; i++) {
+        size_t length = strlen(ret->keys[i]) + 1;
+        memcpy(cursor, ret->keys[i], length);
+        ret->keys[i] = cursor;
+        cursor += length;
+    }
+    ret->slots = (struct slot*)malloc(sizeof(struct slot) * (ret->count + 1));
+    fillSlots(ret, 1, NULL, NULL);
+    free(sorted);
+    return ret;
+}
+
+// The descent turns each comparison into the next index instead of branching on it and
+// always runs to the bottom. Four slots fill a cache line, the line with the grandchildren
+// is prefetched while the current slot is compared. The full key is read only when the
+// heads are equal and neither key ends inside them.
+int frozenContains(FrozenTree* frozen, const char* value) {
+    size_t length = strlen(value);
+    size_t i = 1;
+    int found = 0;
+    while (i <= frozen->count) {
+        __builtin_prefetch(frozen->slots + 4 * i);
+        struct slot* slot = &frozen->slots[i];
+        uint64_t head = loadHead(value, slot->prefix, length);
+        int cmp = (slot->head > head) - (slot->head < head);
+        if (!cmp && (slot->head & 0xff))
+            cmp = strcmp(frozen->keys[i] + slot->prefix + 8, value + slot->prefix + 8);
+        found |= !cmp;
+        i = 2 * i + (cmp CMP 0);
+    }
+    return found;
+}
+
+void freeFrozenTree(FrozenTree* frozen) {
+    free(frozen->slots);
+    free(frozen->keys);
+    free(frozen->strings);
+    free(frozen);
 }
 
 void _freeTree(struct node* root) {
@@ -149,25 +411,210 @@ void _freeTree(struct node* root) {
 
 void freeTree(RBTree* tree) {
     if (tree->root) _freeTree(tree->root);
+    pthread_mutex_destroy(&tree->writer);
     free(tree);
 }
 
-void structure(struct node* root, int level) {
+void structure(Output* out, struct node* root, int level) {
     if (!root) {
-        for (size_t i = 0; i < level; i++)
-            putchar('\t');
-        puts("~");
+        outputRepeat(out, '\t', level);
+        outputString(out, "~\n");
     } else {
-        structure(root->right, level + 1);
-        for (size_t i = 0; i < level; i++)
-            putchar('\t');
-        printf("%c %s\n", (root->color == red) ? 'R' : 'B', root->string);
-        structure(root->left, level + 1);
+        structure(out, root->right, level + 1);
+        outputRepeat(out, '\t', level);
+        outputChar(out, (root->color == red) ? 'R' : 'B');
+        outputChar(out, ' ');
+        outputString(out, root->string);
+        outputChar(out, '\n');
+        structure(out, root->left, level + 1);
     }
 }
 
 void printTree(RBTree* tree) {
-    structure(tree->root, 0);
+    Output* out = newOutput(STDOUT_FILENO);
+    structure(out, tree->root, 0);
+    freeOutput(out);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// URL-like keys that share long prefixes, the case where skipping the common prefix pays off.
+static char** makeUrlKeys(size_t count) {
+    static const char* hosts[] = {"https://www.example.com", "https://api.example.com", "https://cdn.example.org"};
+    char** ret = (char**)malloc(sizeof(char*) * count);
+    char key[128];
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(key, "%s/catalog/v2/products/category-%02u/items/%08x?ref=search", hosts[state % 3],
+                (unsigned)(state >> 8) % 64, (unsigned)(state >> 24));
+        ret[i] = strdup(key);
+    }
+    return ret;
+}
+
+// Adds count URL keys to a fresh tree, then looks every key up once with a plain strcmp
+// descent and once with the prefix-skipping one.
+void benchmarkUrls(size_t count) {
+    RBTree* tree = newRBTree();
+    char** keys = makeUrlKeys(count);
+    double start = now();
+    for (size_t i = 0; i < count; i++)
+        add(tree, keys[i]);
+    double adding = now() - start;
+    size_t found = 0;
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+        struct node* temp = tree->root;
+        while (temp) {
+            int cmp = strcmp(keys[i], temp->string);
+            if (!cmp) {
+                found++;
+                break;
+            }
+            temp = (cmp CMP 0) ? temp->left : temp->right;
+        }
+    }
+    double plain = now() - start;
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+        struct node* parent;
+        int left;
+        found += lookup(tree, keys[i], &parent, &left) != NULL;
+    }
+    double skipping = now() - start;
+    printf("keys: %lu; add: %.1f ns; find strcmp: %.1f ns; find prefix skip: %.1f ns; found: %lu\n", count,
+           adding * 1e9 / count, plain * 1e9 / count, skipping * 1e9 / count, found);
+    for (size_t i = 0; i < count; i++)
+        free(keys[i]);
+    free(keys);
+    freeTree(tree);
+}
+
+// Looks up random keys out of twice the count stored, through the live tree and through
+// a frozen copy of it.
+void benchmarkFrozen(size_t count) {
+    char** keys = makeUrlKeys(count * 2);
+    RBTree* tree = newRBTree();
+    for (size_t i = 0; i < count; i++)
+        add(tree, keys[i]);
+    double start = now();
+    FrozenTree* frozen = freezeTree(tree);
+    double freezing = now() - start;
+    size_t finds = count * 4, live = 0, hits = 0, mismatches = 0;
+    uint64_t state = 88172645463325252ull;
+    start = now();
+    for (size_t i = 0; i < finds; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        live += contains(tree, keys[state % (count * 2)], NULL);
+    }
+    double liveTime = now() - start;
+    state = 88172645463325252ull;
+    start = now();
+    for (size_t i = 0; i < finds; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        hits += frozenContains(frozen, keys[state % (count * 2)]);
+    }
+    double frozenTime = now() - start;
+    for (size_t i = 0; i < count * 2; i++)
+        mismatches += contains(tree, keys[i], NULL) != frozenContains(frozen, keys[i]);
+    printf("keys: %lu; freeze: %.3f s; find live: %.1f ns; find frozen: %.1f ns; hits: %lu/%lu; mismatches: %lu\n",
+           frozen->count, freezing, liveTime * 1e9 / finds, frozenTime * 1e9 / finds, hits, live, mismatches);
+    freeFrozenTree(frozen);
+    freeTree(tree);
+    for (size_t i = 0; i < count * 2; i++)
+        free(keys[i]);
+    free(keys);
+}
+
+struct reader {
+    RBTree* tree;
+    char** keys;
+    size_t count;
+    int* stop;
+    uint64_t state;
+    unsigned long finds;
+    unsigned long hits;
+    unsigned long retries;
+};
+
+static void* readKeys(void* argument) {
+    struct reader* reader = (struct reader*)argument;
+    unsigned long finds = 0, hits = 0;
+    while (!__atomic_load_n(reader->stop, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < 64; i++) {
+            reader->state ^= reader->state << 13;
+            reader->state ^= reader->state >> 7;
+            reader->state ^= reader->state << 17;
+            hits += contains(reader->tree, reader->keys[reader->state % reader->count], &reader->retries);
+        }
+        finds += 64;
+        __atomic_store_n(&reader->finds, finds, __ATOMIC_RELAXED);
+    }
+    reader->hits = hits;
+    return NULL;
+}
+
+// For 1, 2, 4 ... maxThreads reader threads: the tree starts with count URL keys, readers
+// look up random keys out of twice as many while the calling thread adds the rest, one add
+// per 99 finds.
+void benchmarkReaders(size_t count, size_t maxThreads) {
+    char** keys = makeUrlKeys(count * 2);
+    pthread_t* ids = (pthread_t*)malloc(sizeof(pthread_t) * maxThreads);
+    struct reader* readers = (struct reader*)malloc(sizeof(struct reader) * maxThreads);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        RBTree* tree = newRBTree();
+        for (size_t i = 0; i < count; i++)
+            add(tree, keys[i]);
+        int stop = 0;
+        for (size_t i = 0; i < threads; i++) {
+            struct reader* reader = &readers[i];
+            reader->tree = tree;
+            reader->keys = keys;
+            reader->count = count * 2;
+            reader->stop = &stop;
+            reader->state = 88172645463325252ull + i * 0x9e3779b97f4a7c15ull;
+            reader->finds = reader->hits = reader->retries = 0;
+            pthread_create(&ids[i], NULL, readKeys, reader);
+        }
+        size_t adds = count;
+        double start = now(), elapsed;
+        while ((elapsed = now() - start) < 0.5) {
+            unsigned long finds = 0;
+            for (size_t i = 0; i < threads; i++)
+                finds += __atomic_load_n(&readers[i].finds, __ATOMIC_RELAXED);
+            if (adds < count * 2 && (adds - count) * 99 < finds)
+                add(tree, keys[adds++]);
+            else
+                sched_yield();
+        }
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        unsigned long finds = 0, hits = 0, retries = 0;
+        for (size_t i = 0; i < threads; i++) {
+            pthread_join(ids[i], NULL);
+            finds += readers[i].finds;
+            hits += readers[i].hits;
+            retries += readers[i].retries;
+        }
+        printf("threads: %lu; finds: %.2f M/s; hits: %lu; adds: %lu; retries: %lu\n", threads,
+               finds / elapsed * 1e-6, hits, adds - count, retries);
+        freeTree(tree);
+    }
+    for (size_t i = 0; i < count * 2; i++)
+        free(keys[i]);
+    free(keys);
+    free(readers);
+    free(ids);
 }
 
 #undef CMP
@@ -178,7 +625,12 @@ int main(int argc, char** argv) {
     char cmd[maxStringLen];
     puts("usage: a <string> - add\n" \
          "       f <string> - find\n" \
+         "       r <string> - count keys before string\n" \
+         "       k <index> - key at index in order, from 0\n" \
          "       p - print tree\n" \
+         "       b <count> - time adds and finds of count URL keys\n" \
+         "       c <count> <threads> - find throughput of up to threads readers next to a writer\n" \
+         "       z <count> - compare finds in the live tree and in a frozen copy\n" \
          "       q - quit");
     while (1) {
         memset(cmd, 0, maxStringLen);
@@ -196,6 +648,31 @@ int main(int argc, char** argv) {
             case 'f':
                 find(tree, cmd+2);
                 break;
+            case 'r':
+                printf("%lu\n", rank(tree, cmd+2));
+                break;
+            case 'k': {
+                char* key = selectKey(tree, atol(cmd+2));
+                puts(key ? key : "Not Found");
+                break;
+            }
+            case 'b':
+                benchmarkUrls(atol(cmd+2));
+                break;
+            case 'c': {
+                char* rest;
+                long count = strtol(cmd+2, &rest, 10);
+                long threads = strtol(rest, NULL, 10);
+                if (count <= 0 || threads <= 0) {
+                    puts("ERROR: count and threads must be positive");
+                    break;
+                }
+                benchmarkReaders(count, threads);
+                break;
+            }
+            case 'z':
+                benchmarkFrozen(atol(cmd+2));
+                break;
             case 'q':
                 freeTree(tree);
                 return 0;
@@ -0,0 +1,248 @@
+// Red-black tree without parent pointers, insertion in one top-down pass
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "output.h"
+
+#define CMP <
+
+// The node's own colour lives in the low bit of its left link, malloc alignment keeps it free.
+// Links are indexed by direction: 0 is left, 1 is right.
+struct node {
+    uintptr_t left;
+    struct node* right;
+    char* string;
+};
+
+enum {black = 0, red = 1};
+
+typedef struct {
+    struct node* root;
+    size_t count;
+} RBTree;
+
+RBTree* newRBTree();
+void find(RBTree*, char*);
+int add(RBTree*, char*);
+void freeTree(RBTree*);
+void printTree(RBTree*);
+
+static inline struct node* child(struct node* node, int dir) {
+    return dir ? node->right : (struct node*)(node->left & ~(uintptr_t)1);
+}
+
+static inline void setChild(struct node* node, int dir, struct node* value) {
+    if (dir)
+        node->right = value;
+    else
+        node->left = (uintptr_t)value | (node->left & 1);
+}
+
+static inline int isRed(struct node* node) {
+    return node && (node->left & 1);
+}
+
+static inline void setColor(struct node* node, int color) {
+    node->left = (node->left & ~(uintptr_t)1) | color;
+}
+
+RBTree* newRBTree() {
+    RBTree* ret = (RBTree*)malloc(sizeof(RBTree));
+    ret->root = NULL;
+    ret->count = 0;
+    return ret;
+}
+
+void find(RBTree* tree, char* value) {
+    struct node* temp = tree->root;
+    while (temp) {
+        int cmp = strcmp(value, temp->string);
+        if (!cmp) {
+            printf("%c %s\n", isRed(temp) ? 'R' : 'B', temp->string);
+            return;
+        }
+        temp = child(temp, !(cmp CMP 0));
+    }
+    printf("Not Found\n");
+}
+
+// Rotates node away from dir; the old child becomes black and node red.
+static struct node* rotate(struct node* node, int dir) {
+    struct node* save = child(node, !dir);
+    setChild(node, !dir, child(save, dir));
+    setChild(save, dir, node);
+    setColor(node, red);
+    setColor(save, black);
+    return save;
+}
+
+static struct node* rotateDouble(struct node* node, int dir) {
+    setChild(node, !dir, rotate(child(node, !dir), !dir));
+    return rotate(node, dir);
+}
+
+static struct node* newNode(char* value) {
+    struct node* ret = (struct node*)malloc(sizeof(struct node));
+    ret->left = red;
+    ret->right = NULL;
+    ret->string = strdup(value);
+    return ret;
+}
+
+// Splits 4-nodes on the way down by flipping colours and repairs a red parent right
+// away with a single or double rotation at the grandparent. Holding the great-grandparent,
+// grandparent and parent is enough, so no parent links or stack are needed.
+// Returns 1 when the value was inserted.
+int add(RBTree* tree, char* value) {
+    if (!tree->root) {
+        tree->root = newNode(value);
+        setColor(tree->root, black);
+        tree->count++;
+        return 1;
+    }
+    struct node head = {0, tree->root, NULL};
+    struct node* great = &head;
+    struct node* grand = NULL;
+    struct node* parent = NULL;
+    struct node* temp = tree->root;
+    int dir = 0, last = 0, inserted = 0;
+    while (1) {
+        if (!temp) {
+            temp = newNode(value);
+            setChild(parent, dir, temp);
+            inserted = 1;
+        } else if (isRed(child(temp, 0)) && isRed(child(temp, 1))) {
+            setColor(temp, red);
+            setColor(child(temp, 0), black);
+            setColor(child(temp, 1), black);
+        }
+        if (isRed(temp) && isRed(parent)) {
+            int side = child(great, 1) == grand;
+            if (temp == child(parent, last))
+                setChild(great, side, rotate(grand, !last));
+            else
+                setChild(great, side, rotateDouble(grand, !last));
+        }
+        if (inserted)
+            break;
+        int cmp = strcmp(value, temp->string);
+        if (!cmp)
+            break;
+        last = dir;
+        dir = !(cmp CMP 0);
+        if (grand)
+            great = grand;
+        grand = parent;
+        parent = temp;
+        temp = child(temp, dir);
+    }
+    tree->root = head.right;
+    setColor(tree->root, black);
+    tree->count += inserted;
+    return inserted;
+}
+
+void _freeTree(struct node* root) {
+    if (child(root, 0)) {
+        _freeTree(child(root, 0));
+    }
+    if (root->right) {
+        _freeTree(root->right);
+    }
+    free(root->string);
+    free(root);
+}
+
+void freeTree(RBTree* tree) {
+    if (tree->root) _freeTree(tree->root);
+    free(tree);
+}
+
+void structure(Output* out, struct node* root, int level) {
+    if (!root) {
+        outputRepeat(out, '\t', level);
+        outputString(out, "~\n");
+    } else {
+        structure(out, root->right, level + 1);
+        outputRepeat(out, '\t', level);
+        outputChar(out, isRed(root) ? 'R' : 'B');
+        outputChar(out, ' ');
+        outputString(out, root->string);
+        outputChar(out, '\n');
+        structure(out, child(root, 0), level + 1);
+    }
+}
+
+void printTree(RBTree* tree) {
+    Output* out = newOutput(STDOUT_FILENO);
+    structure(out, tree->root, 0);
+    freeOutput(out);
+}
+
+#undef CMP
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Inserts count pseudo-random keys into a fresh tree and reports time and node memory.
+void benchmarkAdd(size_t count) {
+    RBTree* tree = newRBTree();
+    char key[32];
+    uint64_t state = 88172645463325252ull;
+    double start = now();
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(key, "%016llx", (unsigned long long)state);
+        add(tree, key);
+    }
+    double elapsed = now() - start;
+    printf("keys: %lu; %.1f ns/add; node: %lu bytes; nodes: %lu MB\n", tree->count,
+           elapsed * 1e9 / count, sizeof(struct node), tree->count * sizeof(struct node) >> 20);
+    freeTree(tree);
+}
+
+int main(int argc, char** argv) {
+    RBTree* tree = newRBTree();
+    size_t maxStringLen = (argc == 2) ? atoi(argv[1]) : 256;
+    char cmd[maxStringLen];
+    puts("usage: a <string> - add\n" \
+         "       f <string> - find\n" \
+         "       p - print tree\n" \
+         "       b <count> - time count random adds\n" \
+         "       q - quit");
+    while (1) {
+        memset(cmd, 0, maxStringLen);
+        fgets(cmd, maxStringLen-1, stdin);
+        strtok(cmd, "\n");
+        switch (cmd[0]) {
+            case 'a': {
+                add(tree, cmd+2);
+                printTree(tree);
+                break;
+            }
+            case 'p':
+                printTree(tree);
+                break;
+            case 'f':
+                find(tree, cmd+2);
+                break;
+            case 'b':
+                benchmarkAdd(atol(cmd+2));
+                break;
+            case 'q':
+                freeTree(tree);
+                return 0;
+            default:
+                break;
+        }
+    }
+}
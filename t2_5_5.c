@@ -0,0 +1,488 @@
+// Persistent red-black tree. add copies the nodes it changes and publishes a new root,
+// older roots stay valid, so readers iterate a snapshot while the writer goes on.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "output.h"
+
+#define CMP <
+
+// Nodes are never changed once published. version is the one the node was created in,
+// an add may change only the nodes of the version it is building.
+struct node {
+    struct node* left;
+    struct node* right;
+    char* string;
+    unsigned long version;
+    int color;
+};
+
+enum {black = 0, red = 1};
+
+// Nodes replaced while building version are unreachable from it and every later root,
+// they are freed once no snapshot older than version is left.
+typedef struct garbage {
+    struct node** nodes;
+    size_t used;
+    size_t size;
+    unsigned long version;
+    struct garbage* next;
+} Garbage;
+
+typedef struct snapshot {
+    struct node* root;
+    unsigned long version;
+    size_t count;
+    struct snapshot* next;
+} Snapshot;
+
+typedef struct {
+    // guarded by lock
+    struct node* root;
+    unsigned long version;
+    size_t count;
+    Snapshot* snapshots;
+    Garbage* garbage;       // oldest first
+    Garbage* garbageTail;
+    pthread_mutex_t lock;
+    // adds are serialized by writer, the nodes being replaced are collected in pending
+    pthread_mutex_t writer;
+    Garbage* pending;
+} RBTree;
+
+RBTree* newRBTree();
+void find(RBTree*, char*);
+int add(RBTree*, char*);
+void freeTree(RBTree*);
+void printTree(RBTree*);
+Snapshot* acquireSnapshot(RBTree*);
+void releaseSnapshot(RBTree*, Snapshot*);
+
+RBTree* newRBTree() {
+    RBTree* ret = (RBTree*)malloc(sizeof(RBTree));
+    ret->root = NULL;
+    ret->version = 0;
+    ret->count = 0;
+    ret->snapshots = NULL;
+    ret->garbage = ret->garbageTail = NULL;
+    ret->pending = NULL;
+    pthread_mutex_init(&ret->lock, NULL);
+    pthread_mutex_init(&ret->writer, NULL);
+    return ret;
+}
+
+static inline int isRed(struct node* node) {
+    return node && node->color == red;
+}
+
+static Garbage* newGarbage() {
+    Garbage* ret = (Garbage*)malloc(sizeof(Garbage));
+    ret->size = 16;
+    ret->used = 0;
+    ret->nodes = (struct node**)malloc(sizeof(struct node*) * ret->size);
+    ret->next = NULL;
+    return ret;
+}
+
+static void freeGarbage(Garbage* garbage) {
+    for (size_t i = 0; i < garbage->used; i++)
+        free(garbage->nodes[i]);
+    free(garbage->nodes);
+    free(garbage);
+}
+
+// Returns a node of the version being built in place of node, copying it if it is shared.
+static struct node* own(RBTree* tree, struct node* node) {
+    unsigned long version = tree->version + 1;
+    if (node->version == version)
+        return node;
+    struct node* ret = (struct node*)malloc(sizeof(struct node));
+    *ret = *node;
+    ret->version = version;
+    Garbage* pending = tree->pending;
+    if (pending->used == pending->size) {
+        pending->size *= 2;
+        pending->nodes = (struct node**)realloc(pending->nodes, sizeof(struct node*) * pending->size);
+    }
+    pending->nodes[pending->used++] = node;
+    return ret;
+}
+
+static struct node* rotateLeft(RBTree* tree, struct node* node) {
+    struct node* rightNode = own(tree, node->right);
+    node->right = rightNode->left;
+    rightNode->left = node;
+    rightNode->color = node->color;
+    node->color = red;
+    return rightNode;
+}
+
+static struct node* rotateRight(RBTree* tree, struct node* node) {
+    struct node* leftNode = own(tree, node->left);
+    node->left = leftNode->right;
+    leftNode->right = node;
+    leftNode->color = node->color;
+    node->color = red;
+    return leftNode;
+}
+
+static void flipColors(RBTree* tree, struct node* node) {
+    node->color = red;
+    node->left = own(tree, node->left);
+    node->right = own(tree, node->right);
+    node->left->color = black;
+    node->right->color = black;
+}
+
+// Left-leaning insert. A subtree that does not change is returned as is and shared with
+// the previous version, so only the search path and the nodes rotated with it are copied.
+static struct node* insert(RBTree* tree, struct node* node, char* value) {
+    if (!node) {
+        struct node* ret = (struct node*)malloc(sizeof(struct node));
+        ret->left = ret->right = NULL;
+        ret->string = strdup(value);
+        ret->version = tree->version + 1;
+        ret->color = red;
+        return ret;
+    }
+    int cmp = strcmp(value, node->string);
+    if (!cmp)
+        return node;
+    int left = cmp CMP 0;
+    struct node* child = insert(tree, left ? node->left : node->right, value);
+    if (child == (left ? node->left : node->right))
+        return node;
+    node = own(tree, node);
+    if (left)
+        node->left = child;
+    else
+        node->right = child;
+    if (isRed(node->right) && !isRed(node->left))
+        node = rotateLeft(tree, node);
+    if (isRed(node->left) && isRed(node->left->left))
+        node = rotateRight(tree, node);
+    if (isRed(node->left) && isRed(node->right))
+        flipColors(tree, node);
+    return node;
+}
+
+static unsigned long oldestVersion(RBTree* tree) {
+    unsigned long ret = tree->version;
+    for (Snapshot* snapshot = tree->snapshots; snapshot; snapshot = snapshot->next)
+        ret = (snapshot->version < ret) ? snapshot->version : ret;
+    return ret;
+}
+
+// Called with lock held.
+static void reclaim(RBTree* tree) {
+    unsigned long oldest = oldestVersion(tree);
+    while (tree->garbage && tree->garbage->version <= oldest) {
+        Garbage* garbage = tree->garbage;
+        tree->garbage = garbage->next;
+        freeGarbage(garbage);
+    }
+    if (!tree->garbage)
+        tree->garbageTail = NULL;
+}
+
+// The new version is built without the lock, readers only ever see published nodes.
+// Returns 1 when the value was inserted.
+int add(RBTree* tree, char* value) {
+    pthread_mutex_lock(&tree->writer);
+    tree->pending = newGarbage();
+    struct node* root = insert(tree, tree->root, value);
+    if (root == tree->root) {
+        freeGarbage(tree->pending);
+        pthread_mutex_unlock(&tree->writer);
+        return 0;
+    }
+    root->color = black;
+    Garbage* pending = tree->pending;
+    pthread_mutex_lock(&tree->lock);
+    tree->root = root;
+    pending->version = ++tree->version;
+    tree->count++;
+    if (tree->garbageTail)
+        tree->garbageTail->next = pending;
+    else
+        tree->garbage = pending;
+    tree->garbageTail = pending;
+    reclaim(tree);
+    pthread_mutex_unlock(&tree->lock);
+    pthread_mutex_unlock(&tree->writer);
+    return 1;
+}
+
+Snapshot* acquireSnapshot(RBTree* tree) {
+    Snapshot* ret = (Snapshot*)malloc(sizeof(Snapshot));
+    pthread_mutex_lock(&tree->lock);
+    ret->root = tree->root;
+    ret->version = tree->version;
+    ret->count = tree->count;
+    ret->next = tree->snapshots;
+    tree->snapshots = ret;
+    pthread_mutex_unlock(&tree->lock);
+    return ret;
+}
+
+void releaseSnapshot(RBTree* tree, Snapshot* snapshot) {
+    pthread_mutex_lock(&tree->lock);
+    Snapshot** link = &tree->snapshots;
+    while (*link != snapshot)
+        link = &(*link)->next;
+    *link = snapshot->next;
+    reclaim(tree);
+    pthread_mutex_unlock(&tree->lock);
+    free(snapshot);
+}
+
+// Calls visit for every key of the snapshot in order, without taking any lock.
+// The height of a red-black tree stays below 2 * log2(n + 1), well inside the stack.
+void forEach(Snapshot* snapshot, void (*visit)(char*, void*), void* context) {
+    struct node* stack[128];
+    size_t used = 0;
+    struct node* temp = snapshot->root;
+    while (temp || used) {
+        while (temp) {
+            stack[used++] = temp;
+            temp = temp->left;
+        }
+        temp = stack[--used];
+        visit(temp->string, context);
+        temp = temp->right;
+    }
+}
+
+void find(RBTree* tree, char* value) {
+    Snapshot* snapshot = acquireSnapshot(tree);
+    struct node* temp = snapshot->root;
+    while (temp) {
+        int cmp = strcmp(value, temp->string);
+        if (!cmp) {
+            printf("%c %s\n", (temp->color == red) ? 'R' : 'B', temp->string);
+            break;
+        }
+        temp = (cmp CMP 0) ? temp->left : temp->right;
+    }
+    if (!temp)
+        printf("Not Found\n");
+    releaseSnapshot(tree, snapshot);
+}
+
+// Strings are shared by all copies of a node, they go with the latest version.
+void _freeTree(struct node* root) {
+    if (root->left) {
+        _freeTree(root->left);
+    }
+    if (root->right) {
+        _freeTree(root->right);
+    }
+    free(root->string);
+    free(root);
+}
+
+void freeTree(RBTree* tree) {
+    while (tree->snapshots) {
+        Snapshot* snapshot = tree->snapshots;
+        tree->snapshots = snapshot->next;
+        free(snapshot);
+    }
+    while (tree->garbage) {
+        Garbage* garbage = tree->garbage;
+        tree->garbage = garbage->next;
+        freeGarbage(garbage);
+    }
+    if (tree->root) _freeTree(tree->root);
+    pthread_mutex_destroy(&tree->lock);
+    pthread_mutex_destroy(&tree->writer);
+    free(tree);
+}
+
+void structure(Output* out, struct node* root, int level) {
+    if (!root) {
+        outputRepeat(out, '\t', level);
+        outputString(out, "~\n");
+    } else {
+        structure(out, root->right, level + 1);
+        outputRepeat(out, '\t', level);
+        outputChar(out, (root->color == red) ? 'R' : 'B');
+        outputChar(out, ' ');
+        outputString(out, root->string);
+        outputChar(out, '\n');
+        structure(out, root->left, level + 1);
+    }
+}
+
+void printTree(RBTree* tree) {
+    Snapshot* snapshot = acquireSnapshot(tree);
+    Output* out = newOutput(STDOUT_FILENO);
+    structure(out, snapshot->root, 0);
+    freeOutput(out);
+    releaseSnapshot(tree, snapshot);
+}
+
+static void printKey(char* key, void* context) {
+    outputString((Output*)context, key);
+    outputChar((Output*)context, '\n');
+}
+
+void printSnapshot(Snapshot* snapshot) {
+    Output* out = newOutput(STDOUT_FILENO);
+    forEach(snapshot, printKey, out);
+    freeOutput(out);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct reader {
+    RBTree* tree;
+    int* done;
+    size_t snapshots;
+    size_t errors;
+    // state of the current walk
+    char* last;
+    size_t seen;
+};
+
+static void checkKey(char* key, void* context) {
+    struct reader* reader = (struct reader*)context;
+    if (reader->last && strcmp(reader->last, key) >= 0)
+        reader->errors++;
+    reader->last = key;
+    reader->seen++;
+}
+
+// Walks snapshots back to back and checks that each one is sorted and complete.
+static void* readSnapshots(void* argument) {
+    struct reader* reader = (struct reader*)argument;
+    while (!__atomic_load_n(reader->done, __ATOMIC_ACQUIRE)) {
+        Snapshot* snapshot = acquireSnapshot(reader->tree);
+        reader->last = NULL;
+        reader->seen = 0;
+        forEach(snapshot, checkKey, reader);
+        reader->errors += reader->seen != snapshot->count;
+        releaseSnapshot(reader->tree, snapshot);
+        reader->snapshots++;
+    }
+    return NULL;
+}
+
+// Adds count random keys while threads readers iterate snapshots concurrently.
+void benchmarkSnapshots(size_t count, size_t threads) {
+    RBTree* tree = newRBTree();
+    int done = 0;
+    pthread_t* ids = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    struct reader* readers = (struct reader*)calloc(threads, sizeof(struct reader));
+    for (size_t i = 0; i < threads; i++) {
+        readers[i].tree = tree;
+        readers[i].done = &done;
+        pthread_create(&ids[i], NULL, readSnapshots, &readers[i]);
+    }
+    char key[32];
+    uint64_t state = 88172645463325252ull;
+    double start = now();
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(key, "%016llx", (unsigned long long)state);
+        add(tree, key);
+    }
+    double elapsed = now() - start;
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    size_t snapshots = 0, errors = 0;
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        snapshots += readers[i].snapshots;
+        errors += readers[i].errors;
+    }
+    printf("keys: %lu; %.1f ns/add; snapshots walked: %lu; errors: %lu\n", tree->count,
+           elapsed * 1e9 / count, snapshots, errors);
+    free(readers);
+    free(ids);
+    freeTree(tree);
+}
+
+#undef CMP
+
+#define MAX_SNAPSHOTS 64
+
+int main(int argc, char** argv) {
+    RBTree* tree = newRBTree();
+    Snapshot* snapshots[MAX_SNAPSHOTS] = {NULL};
+    size_t maxStringLen = (argc == 2) ? atoi(argv[1]) : 256;
+    char cmd[maxStringLen];
+    puts("usage: a <string> - add\n" \
+         "       f <string> - find\n" \
+         "       p - print tree\n" \
+         "       s - take a snapshot\n" \
+         "       l <n> - list the keys of snapshot n\n" \
+         "       r <n> - release snapshot n\n" \
+         "       b <count> <threads> - time count adds while threads walk snapshots\n" \
+         "       q - quit");
+    while (1) {
+        memset(cmd, 0, maxStringLen);
+        fgets(cmd, maxStringLen-1, stdin);
+        strtok(cmd, "\n");
+        switch (cmd[0]) {
+            case 'a': {
+                add(tree, cmd+2);
+                printTree(tree);
+                break;
+            }
+            case 'p':
+                printTree(tree);
+                break;
+            case 'f':
+                find(tree, cmd+2);
+                break;
+            case 's': {
+                size_t i = 0;
+                while (i < MAX_SNAPSHOTS && snapshots[i])
+                    i++;
+                if (i == MAX_SNAPSHOTS) {
+                    puts("ERROR: too many snapshots");
+                    break;
+                }
+                snapshots[i] = acquireSnapshot(tree);
+                printf("snapshot %lu: %lu keys\n", i, snapshots[i]->count);
+                break;
+            }
+            case 'l':
+            case 'r': {
+                size_t i = atol(cmd+2);
+                if (i >= MAX_SNAPSHOTS || !snapshots[i]) {
+                    puts("ERROR: no such snapshot");
+                    break;
+                }
+                if (cmd[0] == 'l') {
+                    printSnapshot(snapshots[i]);
+                } else {
+                    releaseSnapshot(tree, snapshots[i]);
+                    snapshots[i] = NULL;
+                }
+                break;
+            }
+            case 'b': {
+                char* rest;
+                size_t count = strtoul(cmd+2, &rest, 10);
+                benchmarkSnapshots(count, strtoul(rest, NULL, 10));
+                break;
+            }
+            case 'q':
+                freeTree(tree);
+                return 0;
+            default:
+                break;
+        }
+    }
+}
@@ -1,23 +1,57 @@
-// Hash table, collision resolved by separate chaining using linked list. Dynamic resizing.
+// Hash table, collision resolved by separate chaining using linked list. Dynamic resizing,
+// optionally bounded by a byte budget with least recently used entries evicted first, and
+// optional expiry per entry.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
 
+#include "output.h"
+#include "wheel.h"
+
+// Number of lookups getMany keeps in flight.
+#define GROUP 16
+// Keys getMany looks up before it touches the hits, bounds the nodes it keeps aside.
+#define CHUNK 256
+// Most expired entries each add removes, the rest wait for the next one.
+#define EXPIRE_STEP 16
+
+// Besides its bucket chain every node sits in the recency list of the table, newer points
+// toward the most recently used entry. The timer is in the wheel of the table only while
+// the entry has a time to live.
 struct linkedListNode {
     char* key;
     char* value;
     struct linkedListNode* next;
+    struct linkedListNode* newer;
+    struct linkedListNode* older;
+    Timer timer;
 };
 
 typedef struct {
   struct linkedListNode *first;
 } LinkedList;
 
+// bytes counts every entry as its node plus both strings with their terminators. Once it
+// goes over budget the oldest entries are dropped, budget 0 never drops anything.
 typedef struct table{
     LinkedList** list;
     size_t size;
     size_t used;
+    struct linkedListNode* newest;
+    struct linkedListNode* oldest;
+    size_t bytes;
+    size_t budget;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    Wheel wheel;
+    uint64_t start;     // time of the table is milliseconds since start plus skew
+    uint64_t skew;
+    size_t expired;
 } hashTable;
 
 hashTable* newHashTable();
@@ -26,26 +60,47 @@ void addToHashTable(hashTable*, char*, char*);
 void printHashTable(hashTable*);
 void removeValueForKey(hashTable*, char*);
 const char* getValueForKey(hashTable*, char*);
+void getMany(hashTable*, char**, size_t, const char**);
 unsigned long getStringHash(char*);
+void setBudget(hashTable*, size_t);
+void printStats(hashTable*);
+int setTimeToLive(hashTable*, char*, uint64_t);
+void expireEntries(hashTable*, size_t);
 
 LinkedList* newList();
 void freeList(LinkedList *);
-int addToList(LinkedList*, char*, char*);
+struct linkedListNode* findInList(LinkedList*, char*);
+struct linkedListNode* addToList(LinkedList*, char*, char*);
 void freeNode(struct linkedListNode* );
 
 hashTable* newHashTable() {
     hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
     ret->size = 2;
-    ret->list = (LinkedList**)malloc(ret->size * sizeof(LinkedList));
+    ret->list = (LinkedList**)malloc(ret->size * sizeof(LinkedList*));
     for (size_t i = 0; i < ret->size; i++)
         ret->list[i] = newList();
     ret->used = 0;
+    ret->newest = ret->oldest = NULL;
+    ret->bytes = ret->budget = 0;
+    ret->hits = ret->misses = ret->evictions = 0;
+    ret->start = monotonicMs();
+    ret->skew = 0;
+    ret->expired = 0;
+    initWheel(&ret->wheel, 0);
     return ret;
 }
 
+static inline uint64_t currentTime(hashTable* table) {
+    return monotonicMs() - table->start + table->skew;
+}
+
+static inline int isExpired(struct linkedListNode* node, uint64_t now) {
+    return node->timer.link && node->timer.expires <= now;
+}
+
 unsigned long getStringHash(char* value) {
     unsigned long hash = 7;
-    for (size_t i = 0; i < strlen(value); i++)
+    for (size_t i = 0; value[i]; i++)
         hash = hash * 31 + value[i];
     return hash;
 }
@@ -53,91 +108,303 @@ unsigned long getStringHash(char* value) {
 void freeHashTable(hashTable* table) {
     for (size_t i = 0; i < table->size; i++)
         freeList(table->list[i]);
+    free(table->list);
     free(table);
 }
 
+// Entries with a time to live show the milliseconds left, 0 once they are due.
+void printEntry(Output* out, struct linkedListNode* node, uint64_t now) {
+    outputString(out, "  key: ");
+    outputString(out, node->key);
+    outputString(out, "; value: ");
+    outputString(out, node->value);
+    if (node->timer.link) {
+        outputString(out, "; ttl: ");
+        outputUnsigned(out, isExpired(node, now) ? 0 : node->timer.expires - now);
+    }
+    outputChar(out, '\n');
+}
+
 void printHashTable(hashTable* table) {
-    printf("table size: %lu; used: %lu;\n", table->size, table->used);
+    uint64_t now = currentTime(table);
+    Output* out = newOutput(STDOUT_FILENO);
+    outputString(out, "table size: ");
+    outputUnsigned(out, table->size);
+    outputString(out, "; used: ");
+    outputUnsigned(out, table->used);
+    outputString(out, ";\n");
     for (size_t i = 0; i < table->size; i++) {
-        printf("hash: %lu\n", i);
+        outputString(out, "hash: ");
+        outputUnsigned(out, i);
+        outputChar(out, '\n');
         struct linkedListNode* node = table->list[i]->first;
         while (node) {
-            printf("  key: %s; value: %s\n", node->key, node->value);
+            printEntry(out, node, now);
             node = node->next;
         }
     }
+    freeOutput(out);
+}
+
+static inline size_t entryBytes(struct linkedListNode* node) {
+    return sizeof(struct linkedListNode) + strlen(node->key) + strlen(node->value) + 2;
+}
+
+static void unlinkRecent(hashTable* table, struct linkedListNode* node) {
+    if (node->newer)
+        node->newer->older = node->older;
+    else
+        table->newest = node->older;
+    if (node->older)
+        node->older->newer = node->newer;
+    else
+        table->oldest = node->newer;
+}
+
+static void linkNewest(hashTable* table, struct linkedListNode* node) {
+    node->newer = NULL;
+    node->older = table->newest;
+    if (table->newest)
+        table->newest->newer = node;
+    else
+        table->oldest = node;
+    table->newest = node;
+}
+
+static void touch(hashTable* table, struct linkedListNode* node) {
+    if (table->newest != node) {
+        unlinkRecent(table, node);
+        linkNewest(table, node);
+    }
+}
+
+// Unhooks node from the chain of its bucket and from the recency list and frees it.
+static void dropNode(hashTable* table, struct linkedListNode* node) {
+    struct linkedListNode** link = &table->list[getStringHash(node->key) % table->size]->first;
+    while (*link != node)
+        link = &(*link)->next;
+    *link = node->next;
+    unlinkRecent(table, node);
+    if (node->timer.link)
+        removeTimer(&table->wheel, &node->timer);
+    table->bytes -= entryBytes(node);
+    table->used--;
+    freeNode(node);
+}
+
+static void evict(hashTable* table) {
+    while (table->budget && table->bytes > table->budget) {
+        dropNode(table, table->oldest);
+        table->evictions++;
+    }
+}
+
+void setBudget(hashTable* table, size_t budget) {
+    table->budget = budget;
+    evict(table);
+}
+
+// Removes at most limit entries whose time to live has run out, oldest deadline first.
+void expireEntries(hashTable* table, size_t limit) {
+    uint64_t now = currentTime(table);
+    Timer* timer;
+    while (limit-- && (timer = nextExpired(&table->wheel, now))) {
+        struct linkedListNode* node = (struct linkedListNode*)((char*)timer - offsetof(struct linkedListNode, timer));
+        node->timer.link = NULL;
+        dropNode(table, node);
+        table->expired++;
+    }
+}
+
+// The entry expires ttl milliseconds from now, ttl 0 makes it live until removed.
+// Returns 0 when the key is not in the table.
+int setTimeToLive(hashTable* table, char* key, uint64_t ttl) {
+    struct linkedListNode* node = findInList(table->list[getStringHash(key) % table->size], key);
+    uint64_t now = currentTime(table);
+    if (!node || isExpired(node, now))
+        return 0;
+    if (node->timer.link)
+        removeTimer(&table->wheel, &node->timer);
+    if (ttl) {
+        node->timer.expires = now + ttl;
+        addTimer(&table->wheel, &node->timer);
+    }
+    return 1;
+}
+
+void printStats(hashTable* table) {
+    size_t lookups = table->hits + table->misses;
+    printf("entries: %lu; buckets: %lu; bytes: %lu; budget: %lu; hits: %lu; misses: %lu; "
+           "hit ratio: %.3f; evictions: %lu; timers: %lu; expired: %lu\n", table->used, table->size,
+           table->bytes, table->budget, table->hits, table->misses,
+           lookups ? (double)table->hits / lookups : 0.0, table->evictions, table->wheel.count, table->expired);
 }
 
 const char* getValueForKey(hashTable* table, char* key) {
-    for (size_t i = 0; i < table->size; i++) {
-        struct linkedListNode* node = table->list[i]->first;
-        while (node) {
-            if (!strcmp(key, node->key)) {
-                return node->value;
+    unsigned long index = getStringHash(key) % table->size;
+    struct linkedListNode* node = findInList(table->list[index], key);
+    if (node && node->timer.link && isExpired(node, currentTime(table))) {
+        dropNode(table, node);
+        table->expired++;
+        node = NULL;
+    }
+    if (!node) {
+        table->misses++;
+        return "";
+    }
+    table->hits++;
+    touch(table, node);
+    return node->value;
+}
+
+// One lookup of getMany in flight. Every step reads only what the previous step
+// prefetched and prefetches what the next one needs.
+typedef struct {
+    size_t index;
+    int stage;
+    LinkedList** bucket;
+    struct linkedListNode* node;
+} lookup;
+
+enum {readBucket, readList, readNode, compareKey};
+
+static void startLookup(hashTable* table, lookup* state, char* key, size_t index) {
+    state->index = index;
+    state->bucket = &table->list[getStringHash(key) % table->size];
+    state->stage = readBucket;
+    __builtin_prefetch(state->bucket);
+}
+
+// Returns 1 once the lookup has stored the node it found, NULL for a miss, in found.
+static int stepLookup(lookup* state, char** keys, struct linkedListNode** found) {
+    switch (state->stage) {
+        case readBucket:
+            __builtin_prefetch(*state->bucket);
+            state->stage = readList;
+            return 0;
+        case readList:
+            state->node = (*state->bucket)->first;
+            break;
+        case readNode:
+            __builtin_prefetch(state->node->key);
+            state->stage = compareKey;
+            return 0;
+        case compareKey:
+            if (!strcmp(keys[state->index], state->node->key)) {
+                found[state->index] = state->node;
+                return 1;
             }
-            node = node->next;
+            state->node = state->node->next;
+            break;
+    }
+    if (!state->node) {
+        found[state->index] = NULL;
+        return 1;
+    }
+    __builtin_prefetch(state->node);
+    state->stage = readNode;
+    return 0;
+}
+
+// Same results as count calls of getValueForKey. Up to GROUP lookups are interleaved,
+// each one taking a step in turn, so their cache misses overlap instead of following
+// one another. They finish out of order, so the keys go in chunks of CHUNK whose found
+// nodes are kept aside, then the hits are moved to the front of the recency list in the
+// order of keys. Expired entries count as misses but are left for expireEntries, a batch
+// may name them more than once.
+void getMany(hashTable* table, char** keys, size_t count, const char** values) {
+    struct linkedListNode* found[CHUNK];
+    uint64_t now = currentTime(table);
+    for (size_t base = 0; base < count; base += CHUNK) {
+        size_t size = (count - base < CHUNK) ? count - base : CHUNK;
+        char** chunk = keys + base;
+        lookup group[GROUP];
+        size_t active = 0, next = 0;
+        while (active < GROUP && next < size) {
+            startLookup(table, &group[active], chunk[next], next);
+            active++;
+            next++;
+        }
+        while (active) {
+            for (size_t i = 0; i < active;) {
+                if (!stepLookup(&group[i], chunk, found)) {
+                    i++;
+                } else if (next < size) {
+                    startLookup(table, &group[i], chunk[next], next);
+                    next++;
+                    i++;
+                } else {
+                    group[i] = group[--active];
+                }
+            }
+        }
+        for (size_t i = 0; i < size; i++) {
+            struct linkedListNode* node = found[i];
+            if (!node || isExpired(node, now)) {
+                table->misses++;
+                values[base + i] = "";
+                continue;
+            }
+            table->hits++;
+            touch(table, node);
+            values[base + i] = node->value;
         }
     }
-    return "";
 }
 
+// Nodes whose index changes are relinked into their new bucket, their place in the
+// recency list stays as it is.
 void resizeHashTable(hashTable* table) {
     size_t oldSize = table->size;
     table->size <<= 1;
-    table->list = (LinkedList**)realloc(table->list, sizeof(LinkedList) * table->size);
+    table->list = (LinkedList**)realloc(table->list, sizeof(LinkedList*) * table->size);
     for (size_t i = oldSize; i < table->size; i++)
         table->list[i] = newList();
     for (size_t i = 0; i < oldSize; i++) {
-        LinkedList* list = table->list[i];
-        struct linkedListNode* node = list->first;
-        struct linkedListNode* prevNode = NULL;
-        while (node) {
+        struct linkedListNode** link = &table->list[i]->first;
+        while (*link) {
+            struct linkedListNode* node = *link;
             unsigned long newIndex = getStringHash(node->key) % table->size;
-            if (newIndex >= oldSize) {
-                table->list[newIndex] = newList();
-                addToList(table->list[newIndex], node->key, node->value);
-                if (prevNode) {
-                    prevNode->next = node->next;
-                } else {
-                    list->first = list->first->next;
-                }
-                struct linkedListNode* temp = node->next;
-                freeNode(node);
-                node = temp;
+            if (newIndex != i) {
+                *link = node->next;
+                node->next = table->list[newIndex]->first;
+                table->list[newIndex]->first = node;
             } else {
-                prevNode = node;
-                node = node->next;
+                link = &node->next;
             }
         }
     }
 }
 
+// A new value also drops any time to live the key had.
 void addToHashTable(hashTable* table, char* key, char* value) {
+    expireEntries(table, EXPIRE_STEP);
     unsigned long index = getStringHash(key) % table->size;
-    table->used += addToList(table->list[index], key, value);
+    struct linkedListNode* node = findInList(table->list[index], key);
+    if (node) {
+        table->bytes -= strlen(node->value);
+        free(node->value);
+        node->value = strdup(value);
+        table->bytes += strlen(node->value);
+        if (node->timer.link)
+            removeTimer(&table->wheel, &node->timer);
+        touch(table, node);
+    } else {
+        node = addToList(table->list[index], key, value);
+        table->bytes += entryBytes(node);
+        table->used++;
+        linkNewest(table, node);
+    }
+    evict(table);
     if ((float)(table->used)/(float)(table->size) > 0.5)
         resizeHashTable(table);
 }
 
 void removeValueForKey(hashTable* table, char* key) {
     unsigned long index = getStringHash(key) % table->size;
-    LinkedList* list = table->list[index];
-    struct linkedListNode* node = list->first;
-    struct linkedListNode* prevNode = NULL;
-    while (node) {
-        if (!strcmp(key, node->key)) {
-            if (prevNode) {
-                prevNode->next = node->next;
-            } else {
-                list->first = list->first->next;
-            }
-            freeNode(node);
-            table->used--;
-            return;
-        }
-        prevNode = node;
-        node = node->next;
-    }
+    struct linkedListNode* node = findInList(table->list[index], key);
+    if (node)
+        dropNode(table, node);
 }
 
 LinkedList* newList() {
@@ -146,24 +413,25 @@ LinkedList* newList() {
     return ret;
 }
 
-int addToList(LinkedList* list, char* tempKey, char* tempValue) {
-    char* value = strdup(tempValue);
+struct linkedListNode* findInList(LinkedList* list, char* key) {
     struct linkedListNode* temp = list->first;
     while (temp) {
-        if (!strcmp(tempKey, temp->key)) {
-            free(temp->value);
-            temp->value = value;
-            return 0;
-        }
+        if (!strcmp(key, temp->key))
+            return temp;
         temp = temp->next;
     }
-    char* key = strdup(tempKey);
+    return NULL;
+}
+
+// Puts a new node in front of the list, the key must not be in it yet.
+struct linkedListNode* addToList(LinkedList* list, char* key, char* value) {
     struct linkedListNode* newNode = (struct linkedListNode*)malloc(sizeof(struct linkedListNode));
-    newNode->value = value;
-    newNode->key = key;
+    newNode->value = strdup(value);
+    newNode->key = strdup(key);
+    newNode->timer.link = NULL;
     newNode->next = list->first;
     list->first = newNode;
-    return 1;
+    return newNode;
 }
 
 void freeNode(struct linkedListNode* node) {
@@ -183,6 +451,79 @@ void freeList(LinkedList* list) {
     free(list);
 }
 
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Adds count random keys, then looks up count keys in random order, half of them absent,
+// once with getValueForKey per key and once with getMany.
+void benchmarkGetMany(size_t count) {
+    hashTable* table = newHashTable();
+    char (*strings)[20] = malloc(sizeof(*strings) * count * 2);
+    char** keys = (char**)malloc(sizeof(char*) * count);
+    const char** values = (const char**)malloc(sizeof(char*) * count);
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < count * 2; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(strings[i], "%016llx", (unsigned long long)state);
+        if (i < count)
+            addToHashTable(table, strings[i], strings[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        keys[i] = strings[state % (count * 2)];
+    }
+    size_t hits = 0;
+    double start = now();
+    for (size_t i = 0; i < count; i++)
+        hits += *getValueForKey(table, keys[i]) != 0;
+    double single = now() - start;
+    start = now();
+    getMany(table, keys, count, values);
+    double batched = now() - start;
+    size_t batchHits = 0;
+    for (size_t i = 0; i < count; i++)
+        batchHits += *values[i] != 0;
+    printf("keys: %lu; buckets: %lu; getValueForKey: %.1f ns; getMany: %.1f ns; hits: %lu/%lu\n",
+           table->used, table->size, single * 1e9 / count, batched * 1e9 / count, hits, batchHits);
+    free(values);
+    free(keys);
+    free(strings);
+    freeHashTable(table);
+}
+
+// Adds count keys, gives a tenth of them a time to live of up to a second, moves the clock
+// a second ahead and times removing them, which only touches the expired entries.
+void benchmarkExpiry(size_t count) {
+    hashTable* table = newHashTable();
+    char (*strings)[20] = malloc(sizeof(*strings) * count);
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(strings[i], "%016llx", (unsigned long long)state);
+        addToHashTable(table, strings[i], "x");
+    }
+    for (size_t i = 0; i < count; i += 10)
+        setTimeToLive(table, strings[i], 1 + i / 10 % 1000);
+    size_t timers = table->wheel.count;
+    table->skew += 1000;
+    double start = now();
+    expireEntries(table, SIZE_MAX);
+    double elapsed = now() - start;
+    printf("entries: %lu; expired: %lu of %lu timers; %.3f ms; %.1f ns per expired entry\n",
+           table->used, table->expired, timers, elapsed * 1e3, elapsed * 1e9 / (table->expired ? table->expired : 1));
+    free(strings);
+    freeHashTable(table);
+}
+
 int main(int argc, char** argv) {
     hashTable* table = newHashTable();
     size_t maxStringLen = (argc == 2) ? atoi(argv[1]) : 256;
@@ -190,7 +531,15 @@ int main(int argc, char** argv) {
     puts("usage: a <key> <value> - add\n" \
          "       r <key> - remove\n" \
          "       f <key> - get value for key\n" \
+         "       m <key> <key> ... - get values for several keys in one batch\n" \
          "       p - print table\n" \
+         "       b <count> - time count single and batched lookups\n" \
+         "       l <bytes> - evict least recently used entries beyond bytes, 0 for no limit\n" \
+         "       s - print cache statistics\n" \
+         "       e <key> <ms> - let key expire after ms milliseconds, 0 to keep it\n" \
+         "       t <ms> - move the clock of the table ms milliseconds ahead\n" \
+         "       x - remove every expired entry\n" \
+         "       w <count> - time expiry of a tenth of count entries\n" \
          "       q - quit");
     while (1) {
         memset(cmd, 0, maxStringLen);
@@ -211,9 +560,78 @@ int main(int argc, char** argv) {
             case 'f':
                 printf("%s\n", getValueForKey(table, strtok(NULL, "\n")));
                 break;
+            case 'm': {
+                char* keys[maxStringLen / 2];
+                const char* values[maxStringLen / 2];
+                size_t count = 0;
+                char* key;
+                while ((key = strtok(NULL, " \n")))
+                    keys[count++] = key;
+                getMany(table, keys, count, values);
+                for (size_t i = 0; i < count; i++)
+                    printf("%s\n", values[i]);
+                break;
+            }
             case 'p':
                 printHashTable(table);
                 break;
+            case 'b': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0) {
+                    puts("ERROR: count must be positive");
+                    break;
+                }
+                benchmarkGetMany(atol(count));
+                break;
+            }
+            case 'l': {
+                char* budget = strtok(NULL, "\n");
+                if (!budget || atol(budget) < 0) {
+                    puts("ERROR: budget must not be negative");
+                    break;
+                }
+                setBudget(table, atol(budget));
+                printStats(table);
+                break;
+            }
+            case 's':
+                printStats(table);
+                break;
+            case 'e': {
+                char* key = strtok(NULL, " \n");
+                char* ttl = strtok(NULL, "\n");
+                if (!key || !ttl || atol(ttl) < 0) {
+                    puts("ERROR: usage e <key> <ms>");
+                    break;
+                }
+                if (!setTimeToLive(table, key, atol(ttl)))
+                    puts("ERROR: key not found");
+                else
+                    printHashTable(table);
+                break;
+            }
+            case 't': {
+                char* ms = strtok(NULL, "\n");
+                if (!ms || atol(ms) < 0) {
+                    puts("ERROR: ms must not be negative");
+                    break;
+                }
+                table->skew += atol(ms);
+                break;
+            }
+            case 'x':
+                expireEntries(table, SIZE_MAX);
+                printHashTable(table);
+                break;
+            case 'w': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0) {
+                    puts("ERROR: count must be positive");
+                    break;
+                }
+                benchmarkExpiry(atol(count));
+                break;
+            }
             case 'q':
                 freeHashTable(table);
                 return 0;
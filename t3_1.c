@@ -3,10 +3,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include "output.h"
+#include "frozen.h"
+
+// By default a table doubles once it holds more than MAX_LOAD entries per bucket on average.
+#define MAX_LOAD 2
+
+// hash holds the low 32 bits of each key's hash. Lookups compare them first and call
+// strcmp only on a match, the bucket index is derived from them as well.
+// size stays a multiple of 4 so whole groups of fingerprints can be loaded.
 typedef struct {
     char** key;
     char** value;
+    unsigned int* hash;
     size_t size;
     size_t used;
 } List;
@@ -16,11 +31,14 @@ typedef struct table{
     List** list;
     size_t size;
     size_t used;
+    size_t maxLoad;     // 0 keeps the size fixed
+    Frozen* frozen;     // while set the entries live there and the lists are empty
 } hashTable;
 
 hashTable* newHashTable(size_t);
 void freeHashTable(hashTable*);
 void addToHashTable(hashTable*, char*, char*);
+void resizeHashTable(hashTable*, size_t);
 void printHashTable(hashTable*);
 void removeValueForKey(hashTable*, char*);
 const char* getValueForKey(hashTable*, char*);
@@ -28,8 +46,12 @@ unsigned long getStringHash(char*);
 
 List* newList();
 void freeList(List*);
-int addToList(List*, char*, char*);
+int addToList(List*, char*, char*, unsigned int);
 void resizeList(List*);
+size_t findInList(List*, char*, unsigned int);
+
+Frozen* freezeHashTable(hashTable*);
+void thawHashTable(hashTable*);
 
 hashTable* newHashTable(size_t size) {
     hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
@@ -38,6 +60,8 @@ hashTable* newHashTable(size_t size) {
     for (size_t i = 0; i < ret->size; i++)
         ret->list[i] = newList();
     ret->used = 0;
+    ret->maxLoad = MAX_LOAD;
+    ret->frozen = NULL;
     return ret;
 }
 
@@ -51,52 +75,115 @@ unsigned long getStringHash(char* value) {
 void freeHashTable(hashTable* table) {
     for (size_t i = 0; i < table->size; i++)
         freeList(table->list[i]);
+    free(table->list);
+    if (table->frozen)
+        freeFrozen(table->frozen);
     free(table);
 }
 
+void printEntry(Output* out, const char* key, const char* value) {
+    outputString(out, "  key: ");
+    outputString(out, key);
+    outputString(out, "; value: ");
+    outputString(out, value);
+    outputChar(out, '\n');
+}
+
 void printHashTable(hashTable* table) {
-    printf("table size: %lu; used: %lu;\n", table->size, table->used);
+    Output* out = newOutput(STDOUT_FILENO);
+    Frozen* frozen = table->frozen;
+    if (frozen) {
+        outputString(out, "frozen keys: ");
+        outputUnsigned(out, frozen->count);
+        outputString(out, "; buckets: ");
+        outputUnsigned(out, frozen->buckets);
+        outputString(out, ";\n");
+        for (size_t i = 0; i < frozen->count; i++) {
+            const char* key = frozen->strings + frozen->entry[i].offset;
+            printEntry(out, key, key + strlen(key) + 1);
+        }
+        freeOutput(out);
+        return;
+    }
+    outputString(out, "table size: ");
+    outputUnsigned(out, table->size);
+    outputString(out, "; used: ");
+    outputUnsigned(out, table->used);
+    outputString(out, ";\n");
     for (size_t i = 0; i < table->size; i++) {
-        printf("hash: %lu\n", i);
+        outputString(out, "hash: ");
+        outputUnsigned(out, i);
+        outputChar(out, '\n');
         List* list = table->list[i];
         for (size_t i = 0; i < list->used; i++)
-            printf("  key: %s; value: %s\n", list->key[i], list->value[i]);
+            printEntry(out, list->key[i], list->value[i]);
     }
+    freeOutput(out);
 }
 
 const char* getValueForKey(hashTable* table, char* key) {
-    unsigned long index = getStringHash(key) % table->size;
-    List* list = table->list[index];
-    for (size_t i = 0; i < list->used; i++)
-        if (!strcmp(list->key[i], key))
-            return list->value[i];
-    return NULL;
+    if (table->frozen)
+        return findFrozen(table->frozen, key);
+    unsigned int hash = getStringHash(key);
+    List* list = table->list[hash % table->size];
+    size_t i = findInList(list, key, hash);
+    return (i < list->used) ? list->value[i] : NULL;
 }
 
 void addToHashTable(hashTable* table, char* key, char* value) {
-    unsigned long index = getStringHash(key) % table->size;
-    table->used += addToList(table->list[index], key, value);
+    unsigned int hash = getStringHash(key);
+    table->used += addToList(table->list[hash % table->size], key, value, hash);
+    if (table->maxLoad && table->used > table->size * table->maxLoad)
+        resizeHashTable(table, table->size * 2);
 }
 
-void removeValueForKey(hashTable* table, char* key) {
-    unsigned long index = getStringHash(key) % table->size;
-    List* list = table->list[index];
-    for (size_t i = 0; i < list->used; i++) {
-        if (!strcmp(list->key[i], key)) {
-            free(list->key[i]);
-            free(list->value[i]);
-            list->used--;
-            table->used--;
-            return;
+// Moves every entry into size new buckets. The index comes from the stored fingerprint,
+// so neither keys nor values are read or copied.
+void resizeHashTable(hashTable* table, size_t size) {
+    List** lists = (List**)malloc(size * sizeof(List*));
+    for (size_t i = 0; i < size; i++)
+        lists[i] = newList();
+    for (size_t i = 0; i < table->size; i++) {
+        List* list = table->list[i];
+        for (size_t j = 0; j < list->used; j++) {
+            List* target = lists[list->hash[j] % size];
+            if (target->used == target->size)
+                resizeList(target);
+            target->key[target->used] = list->key[j];
+            target->value[target->used] = list->value[j];
+            target->hash[target->used] = list->hash[j];
+            target->used++;
         }
+        list->used = 0;
+        freeList(list);
     }
+    free(table->list);
+    table->list = lists;
+    table->size = size;
+}
+
+void removeValueForKey(hashTable* table, char* key) {
+    unsigned int hash = getStringHash(key);
+    List* list = table->list[hash % table->size];
+    size_t i = findInList(list, key, hash);
+    if (i == list->used)
+        return;
+    free(list->key[i]);
+    free(list->value[i]);
+    size_t tail = list->used - i - 1;
+    memmove(list->key + i, list->key + i + 1, sizeof(char*) * tail);
+    memmove(list->value + i, list->value + i + 1, sizeof(char*) * tail);
+    memmove(list->hash + i, list->hash + i + 1, sizeof(unsigned int) * tail);
+    list->used--;
+    table->used--;
 }
 
 List* newList() {
     List* ret = (List*)malloc(sizeof(List));
-    ret->size = 2;
+    ret->size = 4;
     ret->key = (char**)malloc(sizeof(char*) * ret->size);
     ret->value = (char**)malloc(sizeof(char*) * ret->size);
+    ret->hash = (unsigned int*)malloc(sizeof(unsigned int) * ret->size);
     ret->used = 0;
     return ret;
 }
@@ -105,19 +192,47 @@ void resizeList(List* list) {
     list->size *= 2;
     list->key = (char**)realloc(list->key, sizeof(char*) * list->size);
     list->value = (char**)realloc(list->value, sizeof(char*) * list->size);
+    list->hash = (unsigned int*)realloc(list->hash, sizeof(unsigned int) * list->size);
+}
+
+// Returns the position of key in the list, or list->used if it is not there.
+// With SSE2 four fingerprints are compared at once, lanes past used are masked off.
+size_t findInList(List* list, char* key, unsigned int hash) {
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi32(hash);
+    for (size_t i = 0; i < list->used; i += 4) {
+        __m128i group = _mm_loadu_si128((const __m128i*)(list->hash + i));
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(group, needle)));
+        if (list->used - i < 4)
+            mask &= (1u << (list->used - i)) - 1;
+        while (mask) {
+            size_t j = i + __builtin_ctz(mask);
+            if (!strcmp(list->key[j], key))
+                return j;
+            mask &= mask - 1;
+        }
+    }
+#else
+    for (size_t i = 0; i < list->used; i++)
+        if (list->hash[i] == hash && !strcmp(list->key[i], key))
+            return i;
+#endif
+    return list->used;
 }
 
-int addToList(List* list, char* key, char* value) {
-    size_t oldSize = list->used++;
+int addToList(List* list, char* key, char* value, unsigned int hash) {
+    size_t i = findInList(list, key, hash);
+    if (i < list->used) {
+        free(list->value[i]);
+        list->value[i] = strdup(value);
+        return 0;
+    }
     if (list->used == list->size)
         resizeList(list);
-    for (size_t i = 0; i < oldSize; i++)
-        if (!strcmp(key, list->key[i])) {
-            list->value[i] = strdup(value);
-            return 0;
-        }
-    list->key[oldSize] = strdup(key);
-    list->value[oldSize] = strdup(value);
+    list->key[i] = strdup(key);
+    list->value[i] = strdup(value);
+    list->hash[i] = hash;
+    list->used++;
     return 1;
 }
 
@@ -126,9 +241,88 @@ void freeList(List* list) {
         free(list->key[i]);
         free(list->value[i]);
     }
+    free(list->key);
+    free(list->value);
+    free(list->hash);
     free(list);
 }
 
+// Moves every entry of the table into a new frozen form and leaves the lists empty.
+// Lookups go to the frozen form until the table is thawed, writes are refused.
+Frozen* freezeHashTable(hashTable* table) {
+    size_t count = table->used;
+    char** key = (char**)malloc((count + 1) * sizeof(char*));
+    char** value = (char**)malloc((count + 1) * sizeof(char*));
+    for (size_t i = 0, n = 0; i < table->size; i++) {
+        List* list = table->list[i];
+        for (size_t j = 0; j < list->used; j++, n++) {
+            key[n] = list->key[j];
+            value[n] = list->value[j];
+        }
+        list->used = 0;
+    }
+    table->used = 0;
+    Frozen* frozen = freezeEntries(key, value, count);
+    free(key);
+    free(value);
+    return frozen;
+}
+
+// Puts the entries of the frozen form back into the lists, which can grow again.
+void thawHashTable(hashTable* table) {
+    Frozen* frozen = table->frozen;
+    table->frozen = NULL;
+    for (size_t i = 0; i < frozen->count; i++) {
+        char* key = frozen->strings + frozen->entry[i].offset;
+        addToHashTable(table, key, key + strlen(key) + 1);
+    }
+    freeFrozen(frozen);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Fills a table of the given size with count keys and times finds, half of them misses.
+// The table does not grow, so the buckets get as long as count / size. Then it is frozen
+// and the same finds are timed on the frozen form.
+void benchmarkFind(size_t size, size_t count) {
+    hashTable* table = newHashTable(size);
+    table->maxLoad = 0;
+    char key[64];
+    for (size_t i = 0; i < count; i++) {
+        sprintf(key, "https://www.example.com/items/%08lu", i);
+        addToHashTable(table, key, "value");
+    }
+    size_t finds = 0, hits = 0;
+    double start = now(), elapsed;
+    do {
+        for (size_t i = 0; i < count * 2; i++) {
+            sprintf(key, "https://www.example.com/items/%08lu", i);
+            hits += getValueForKey(table, key) != NULL;
+        }
+        finds += count * 2;
+    } while ((elapsed = now() - start) < 1);
+    printf("size: %lu; keys: %lu; %.1f ns/find; hits: %lu/%lu\n", size, table->used,
+           elapsed * 1e9 / finds, hits, finds);
+    start = now();
+    table->frozen = freezeHashTable(table);
+    printf("frozen in %.3f s\n", now() - start);
+    finds = hits = 0;
+    start = now();
+    do {
+        for (size_t i = 0; i < count * 2; i++) {
+            sprintf(key, "https://www.example.com/items/%08lu", i);
+            hits += getValueForKey(table, key) != NULL;
+        }
+        finds += count * 2;
+    } while ((elapsed = now() - start) < 1);
+    printf("frozen: %.1f ns/find; hits: %lu/%lu\n", elapsed * 1e9 / finds, hits, finds);
+    freeHashTable(table);
+}
+
 int main(int argc, char** argv) {
     hashTable* table = newHashTable(10);
     size_t maxStringLen = (argc == 2) ? atoi(argv[1]) : 256;
@@ -137,10 +331,20 @@ int main(int argc, char** argv) {
          "       r <key> - remove\n" \
          "       f <key> - get value for key\n" \
          "       p - print table\n" \
+         "       b <count> - time finds with count keys in a table of the current size that does not grow\n" \
+         "       c <size> - rehash into size buckets\n" \
+         "       z - freeze into a read only table with a minimal perfect hash\n" \
+         "       u - thaw a frozen table so it takes writes again\n" \
+         "       w <file> - write the frozen table to file\n" \
+         "       l <file> - load a frozen table from file, replacing the contents\n" \
          "       q - quit");
     while (1) {
         fgets(cmd, maxStringLen-1, stdin);
         char* token = strtok(cmd, " ");
+        if (table->frozen && cmd[0] && strchr("arc", cmd[0])) {
+            puts("ERROR: table is frozen, u to thaw it");
+            continue;
+        }
         switch (cmd[0]) {
             case 'a': {
                 char* key = strtok(NULL, " ");
@@ -167,10 +371,56 @@ int main(int argc, char** argv) {
             case 'q':
                 freeHashTable(table);
                 return 0;
-            case 'c':
+            case 'b': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0) {
+                    puts("ERROR: count must be positive");
+                    break;
+                }
+                benchmarkFind(table->size, atol(count));
+                break;
+            }
+            case 'z':
+                if (!table->frozen)
+                    table->frozen = freezeHashTable(table);
+                printHashTable(table);
+                break;
+            case 'u':
+                if (table->frozen)
+                    thawHashTable(table);
+                printHashTable(table);
+                break;
+            case 'w': {
+                char* path = strtok(NULL, "\n");
+                if (!table->frozen)
+                    puts("ERROR: table is not frozen, z to freeze it");
+                else if (!path || !saveFrozen(table->frozen, path))
+                    puts("ERROR: could not write file");
+                break;
+            }
+            case 'l': {
+                char* path = strtok(NULL, "\n");
+                Frozen* frozen = path ? loadFrozen(path) : NULL;
+                if (!frozen) {
+                    puts("ERROR: could not load file");
+                    break;
+                }
                 freeHashTable(table);
-                table = newHashTable(atoi(strtok(NULL, "\n")));
+                table = newHashTable(10);
+                table->frozen = frozen;
+                printHashTable(table);
+                break;
+            }
+            case 'c': {
+                char* size = strtok(NULL, "\n");
+                if (!size || atoi(size) <= 0) {
+                    puts("ERROR: size must be positive");
+                    break;
+                }
+                resizeHashTable(table, atoi(size));
+                printHashTable(table);
                 break;
+            }
             default:
                 break;
         }
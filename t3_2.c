@@ -4,6 +4,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "output.h"
+
+// By default a table doubles once it holds more than MAX_LOAD entries per bucket on average.
+#define MAX_LOAD 2
+
 struct linkedListNode {
     char* key;
     char* value;
@@ -18,11 +23,13 @@ typedef struct table{
     LinkedList** list;
     size_t size;
     size_t used;
+    size_t maxLoad;     // 0 keeps the size fixed
 } hashTable;
 
 hashTable* newHashTable(size_t);
 void freeHashTable(hashTable*);
 void addToHashTable(hashTable*, char*, char*);
+void resizeHashTable(hashTable*, size_t);
 void printHashTable(hashTable*);
 void removeValueForKey(hashTable*, char*);
 const char* getValueForKey(hashTable*, char*);
@@ -40,6 +47,7 @@ hashTable* newHashTable(size_t size) {
     for (size_t i = 0; i < ret->size; i++)
         ret->list[i] = newList();
     ret->used = 0;
+    ret->maxLoad = MAX_LOAD;
     return ret;
 }
 
@@ -53,29 +61,45 @@ unsigned long getStringHash(char* value) {
 void freeHashTable(hashTable* table) {
     for (size_t i = 0; i < table->size; i++)
         freeList(table->list[i]);
+    free(table->list);
     free(table);
 }
 
+void printEntry(Output* out, const char* key, const char* value) {
+    outputString(out, "  key: ");
+    outputString(out, key);
+    outputString(out, "; value: ");
+    outputString(out, value);
+    outputChar(out, '\n');
+}
+
 void printHashTable(hashTable* table) {
-    printf("table size: %lu; used: %lu;\n", table->size, table->used);
+    Output* out = newOutput(STDOUT_FILENO);
+    outputString(out, "table size: ");
+    outputUnsigned(out, table->size);
+    outputString(out, "; used: ");
+    outputUnsigned(out, table->used);
+    outputString(out, ";\n");
     for (size_t i = 0; i < table->size; i++) {
-        printf("hash: %lu\n", i);
+        outputString(out, "hash: ");
+        outputUnsigned(out, i);
+        outputChar(out, '\n');
         struct linkedListNode* node = table->list[i]->first;
         while (node) {
-            printf("  key: %s; value: %s\n", node->key, node->value);
+            printEntry(out, node->key, node->value);
             node = node->next;
         }
     }
+    freeOutput(out);
 }
 
 const char* getValueForKey(hashTable* table, char* key) {
-    for (size_t i = 0; i < table->size; i++) {
-        struct linkedListNode* node = table->list[i]->first;
-        while (node) {
-            if (!strcmp(key, node->key))
-                return node->value;
-            node = node->next;
-        }
+    unsigned long index = getStringHash(key) % table->size;
+    struct linkedListNode* node = table->list[index]->first;
+    while (node) {
+        if (!strcmp(key, node->key))
+            return node->value;
+        node = node->next;
     }
     return NULL;
 }
@@ -83,6 +107,29 @@ const char* getValueForKey(hashTable* table, char* key) {
 void addToHashTable(hashTable* table, char* key, char* value) {
     unsigned long index = getStringHash(key) % table->size;
     table->used += addToList(table->list[index], key, value);
+    if (table->maxLoad && table->used > table->size * table->maxLoad)
+        resizeHashTable(table, table->size * 2);
+}
+
+// Relinks every node into size new buckets, keys and values stay where they are.
+void resizeHashTable(hashTable* table, size_t size) {
+    LinkedList** lists = (LinkedList**)malloc(size * sizeof(LinkedList*));
+    for (size_t i = 0; i < size; i++)
+        lists[i] = newList();
+    for (size_t i = 0; i < table->size; i++) {
+        struct linkedListNode* node = table->list[i]->first;
+        while (node) {
+            struct linkedListNode* next = node->next;
+            LinkedList* target = lists[getStringHash(node->key) % size];
+            node->next = target->first;
+            target->first = node;
+            node = next;
+        }
+        free(table->list[i]);
+    }
+    free(table->list);
+    table->list = lists;
+    table->size = size;
 }
 
 void removeValueForKey(hashTable* table, char* key) {
@@ -157,6 +204,7 @@ int main(int argc, char** argv) {
          "       r <key> - remove\n" \
          "       f <key> - get value for key\n" \
          "       p - print table\n" \
+         "       c <size> - rehash into size buckets\n" \
          "       q - quit");
     while (1) {
         fgets(cmd, maxStringLen-1, stdin);
@@ -187,10 +235,16 @@ int main(int argc, char** argv) {
             case 'q':
                 freeHashTable(table);
                 return 0;
-            case 'c':
-                freeHashTable(table);
-                table = newHashTable(atoi(strtok(NULL, "\n")));
+            case 'c': {
+                char* size = strtok(NULL, "\n");
+                if (!size || atoi(size) <= 0) {
+                    puts("ERROR: size must be positive");
+                    break;
+                }
+                resizeHashTable(table, atoi(size));
+                printHashTable(table);
                 break;
+            }
             default:
                 break;
         }
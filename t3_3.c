@@ -1,38 +1,55 @@
-// Hash table, collision resolved by separate chaining using binary search tree.
+// Hash table, collision resolved by separate chaining using AVL tree.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "output.h"
+
+// By default a table doubles once it holds more than MAX_LOAD entries per bucket on average.
+#define MAX_LOAD 2
 
 typedef struct treeNode {
     char* key;
     char* value;
     struct treeNode* left;
     struct treeNode* right;
+    int height;
 } treeNode;
 
 typedef struct {
   struct treeNode* root;
 } Tree;
 
+// Keys are hashed with SipHash under a random per-table seed, so colliding keys cannot
+// be prepared in advance. keyed = 0 falls back to the old unkeyed polynomial hash.
 typedef struct {
     Tree** list;
     size_t size;
+    size_t used;
+    size_t maxLoad;     // 0 keeps the size fixed
+    uint64_t seed[2];
+    int keyed;
 } hashTable;
 
 hashTable* newHashTable(size_t);
 void freeHashTable(hashTable*);
 void addToHashTable(hashTable*, char*, char*);
+void resizeHashTable(hashTable*, size_t);
 void printHashTable(hashTable*);
 void removeValueForKey(hashTable*, char*);
 const char* getValueForKey(hashTable*, char*);
-unsigned long getStringHash(char*);
+uint64_t getStringHash(hashTable*, const char*);
 
 Tree* newTree();
 void freeTree(Tree*);
-void addToTree(Tree*, char*, char*);
+int addToTree(Tree*, char*, char*);
 void freeTreeNode(treeNode*);
-void removeFromTree(Tree*, char*);
+int removeFromTree(Tree*, char*);
+void linkTreeNode(Tree*, treeNode*);
 
 void freeTreeNode(treeNode* node) {
     free(node->key);
@@ -59,15 +76,66 @@ Tree* newTree() {
 hashTable* newHashTable(size_t size) {
     hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
     ret->size = size;
-    ret->list = (Tree**)malloc(ret->size * sizeof(Tree));
+    ret->list = (Tree**)malloc(ret->size * sizeof(Tree*));
     for (size_t i = 0; i < ret->size; i++)
         ret->list[i] = newTree();
+    ret->used = 0;
+    ret->maxLoad = MAX_LOAD;
+    if (getrandom(ret->seed, sizeof(ret->seed), 0) != sizeof(ret->seed)) {
+        ret->seed[0] = (uint64_t)time(NULL) ^ (uintptr_t)ret;
+        ret->seed[1] = (uint64_t)clock() ^ ((uintptr_t)ret->list << 17);
+    }
+    ret->keyed = 1;
     return ret;
 }
 
-unsigned long getStringHash(char* value) {
-    unsigned long hash = 7;
-    for (size_t i = 0; i < strlen(value); i++)
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                     \
+    do {                                                             \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);    \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                       \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                       \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);    \
+    } while (0)
+
+// SipHash-2-4 of the string under the table's seed.
+static uint64_t sipHash(const uint64_t seed[2], const char* value) {
+    size_t length = strlen(value);
+    uint64_t v0 = seed[0] ^ 0x736f6d6570736575ull;
+    uint64_t v1 = seed[1] ^ 0x646f72616e646f6dull;
+    uint64_t v2 = seed[0] ^ 0x6c7967656e657261ull;
+    uint64_t v3 = seed[1] ^ 0x7465646279746573ull;
+    const unsigned char* bytes = (const unsigned char*)value;
+    size_t blocks = length / 8;
+    for (size_t i = 0; i < blocks; i++, bytes += 8) {
+        uint64_t m;
+        memcpy(&m, bytes, 8);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    uint64_t last = (uint64_t)length << 56;
+    for (size_t i = 0; i < length % 8; i++)
+        last |= (uint64_t)bytes[i] << (8 * i);
+    v3 ^= last;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= last;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t getStringHash(hashTable* table, const char* value) {
+    if (table->keyed)
+        return sipHash(table->seed, value);
+    uint64_t hash = 7;
+    for (size_t i = 0; value[i]; i++)
         hash = hash * 31 + value[i];
     return hash;
 }
@@ -75,27 +143,38 @@ unsigned long getStringHash(char* value) {
 void freeHashTable(hashTable* table) {
     for (size_t i = 0; i < table->size; i++)
         freeTree(table->list[i]);
+    free(table->list);
     free(table);
 }
 
-void printTreeNode(struct treeNode* node) {
-    printf("  key: %s; value: %s\n", node->key, node->value);
+void printEntry(Output* out, const char* key, const char* value) {
+    outputString(out, "  key: ");
+    outputString(out, key);
+    outputString(out, "; value: ");
+    outputString(out, value);
+    outputChar(out, '\n');
+}
+
+void printTreeNode(Output* out, struct treeNode* node) {
+    printEntry(out, node->key, node->value);
     if (node->left)
-        printTreeNode(node->left);
+        printTreeNode(out, node->left);
     if (node->right)
-        printTreeNode(node->right);
+        printTreeNode(out, node->right);
 }
 
 void printHashTable(hashTable* table) {
+    Output* out = newOutput(STDOUT_FILENO);
     for (size_t i = 0; i < table->size; i++) {
         treeNode* node = table->list[i]->root;
         if (node)
-            printTreeNode(node);
+            printTreeNode(out, node);
     }
+    freeOutput(out);
 }
 
 const char* getValueForKey(hashTable* table, char* key) {
-    unsigned long index = getStringHash(key) % table->size;
+    unsigned long index = getStringHash(table, key) % table->size;
     treeNode* node = table->list[index]->root;
     while (node) {
         int cmp = strcmp(node->key, key);
@@ -106,93 +185,222 @@ const char* getValueForKey(hashTable* table, char* key) {
 }
 
 void addToHashTable(hashTable* table, char* key, char* value) {
-    unsigned long index = getStringHash(key) % table->size;
-    addToTree(table->list[index], key, value);
+    unsigned long index = getStringHash(table, key) % table->size;
+    table->used += addToTree(table->list[index], key, value);
+    if (table->maxLoad && table->used > table->size * table->maxLoad)
+        resizeHashTable(table, table->size * 2);
+}
+
+// Moves every node into size new buckets, in preorder of the old trees. Keys and values
+// stay where they are, only the links change.
+void resizeHashTable(hashTable* table, size_t size) {
+    Tree** lists = (Tree**)malloc(size * sizeof(Tree*));
+    for (size_t i = 0; i < size; i++)
+        lists[i] = newTree();
+    size_t stackSize = 64, used = 0;
+    treeNode** stack = (treeNode**)malloc(sizeof(treeNode*) * stackSize);
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->list[i]->root)
+            stack[used++] = table->list[i]->root;
+        while (used) {
+            treeNode* node = stack[--used];
+            if (used + 2 > stackSize) {
+                stackSize *= 2;
+                stack = (treeNode**)realloc(stack, sizeof(treeNode*) * stackSize);
+            }
+            if (node->right)
+                stack[used++] = node->right;
+            if (node->left)
+                stack[used++] = node->left;
+            linkTreeNode(lists[getStringHash(table, node->key) % size], node);
+        }
+        free(table->list[i]);
+    }
+    free(stack);
+    free(table->list);
+    table->list = lists;
+    table->size = size;
 }
 
 void removeValueForKey(hashTable* table, char* key) {
-    unsigned long index = getStringHash(key) % table->size;
-    removeFromTree(table->list[index], key);
+    unsigned long index = getStringHash(table, key) % table->size;
+    table->used -= removeFromTree(table->list[index], key);
 }
 
-static inline void fillTreeNode(struct treeNode* node, char* key, char* value) {
-    node->left = node->right = NULL;
-    node->key = strdup(key);
-    node->value = strdup(value);
+static inline int height(treeNode* node) {
+    return node ? node->height : 0;
 }
 
-void addToTree(Tree* tree, char* key, char* value) {
-    treeNode* node = tree->root;
-    if (!node) {
-        tree->root = (treeNode*)malloc(sizeof(treeNode));
-        fillTreeNode(tree->root, key, value);
-        return;
+static inline void updateHeight(treeNode* node) {
+    int left = height(node->left), right = height(node->right);
+    node->height = ((left > right) ? left : right) + 1;
+}
+
+static treeNode* rotateLeft(treeNode* node) {
+    treeNode* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    updateHeight(node);
+    updateHeight(right);
+    return right;
+}
+
+static treeNode* rotateRight(treeNode* node) {
+    treeNode* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    updateHeight(node);
+    updateHeight(left);
+    return left;
+}
+
+// Restores the AVL condition at node after one of its subtrees changed height by one,
+// returns the new root of the subtree.
+static treeNode* balance(treeNode* node) {
+    updateHeight(node);
+    int factor = height(node->left) - height(node->right);
+    if (factor > 1) {
+        if (height(node->left->left) < height(node->left->right))
+            node->left = rotateLeft(node->left);
+        return rotateRight(node);
     }
-    treeNode* prev = node;
-    int cmp = 0;
-    while (node) {
-        cmp = strcmp(node->key, key);
-        if (!cmp) {
-            free(node->value);
-            node->value = strdup(value);
-            return;
-        }
-        prev = node;
-        node = (cmp > 0) ? node->left : node->right;
+    if (factor < -1) {
+        if (height(node->right->right) < height(node->right->left))
+            node->right = rotateRight(node->right);
+        return rotateLeft(node);
     }
+    return node;
+}
+
+// The key of node must not be in the subtree yet. Recursion depth is the tree height,
+// which AVL keeps below 1.45 * log2(n + 2).
+static treeNode* insertNode(treeNode* root, treeNode* node) {
+    if (!root)
+        return node;
+    if (strcmp(root->key, node->key) > 0)
+        root->left = insertNode(root->left, node);
+    else
+        root->right = insertNode(root->right, node);
+    return balance(root);
+}
+
+static treeNode* removeMin(treeNode* root, treeNode** min) {
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+    root->left = removeMin(root->left, min);
+    return balance(root);
+}
+
+static treeNode* removeNode(treeNode* root, char* key, int* removed) {
+    if (!root)
+        return NULL;
+    int cmp = strcmp(root->key, key);
     if (cmp > 0) {
-        prev->left = (treeNode*)malloc(sizeof(treeNode));
-        fillTreeNode(prev->left, key, value);
+        root->left = removeNode(root->left, key, removed);
+    } else if (cmp < 0) {
+        root->right = removeNode(root->right, key, removed);
     } else {
-        prev->right = (treeNode*)malloc(sizeof(treeNode));
-        fillTreeNode(prev->right, key, value);
+        treeNode* left = root->left;
+        treeNode* right = root->right;
+        free(root->key);
+        free(root->value);
+        free(root);
+        *removed = 1;
+        if (!right)
+            return left;
+        treeNode* min;
+        right = removeMin(right, &min);
+        min->left = left;
+        min->right = right;
+        return balance(min);
     }
+    return balance(root);
 }
 
-void removeFromTree(Tree* tree, char* key) {
+// Attaches node, the key must not be in the tree yet.
+void linkTreeNode(Tree* tree, treeNode* node) {
+    node->left = node->right = NULL;
+    node->height = 1;
+    tree->root = insertNode(tree->root, node);
+}
+
+// Returns 1 when the key was not in the tree yet.
+int addToTree(Tree* tree, char* key, char* value) {
     treeNode* node = tree->root;
-    treeNode* prev = node;
     while (node) {
         int cmp = strcmp(node->key, key);
         if (!cmp) {
-            if (!node->left && !node->right) {
-                if (node == tree->root)
-                    tree->root = NULL;
-                if (node == prev->left)
-                    prev->left = NULL;
-                else
-                    prev->right = NULL;
-                freeTreeNode(node);
-            } else if (node->left && node->right) {
-                if (!node->right->left) {
-                    node->key = node->right->key;
-                    node->value = node->right->value;
-                    treeNode* temp = node->right->right;
-                    free(node->right);
-                    node->right = temp;
-                } else {
-                    treeNode* temp = node->right;
-                    while (temp->left->left)
-                        temp = temp->left;
-                    char* newKey = temp->left->key;
-                    char* newValue = temp->left->value;
-                    removeFromTree(tree, newKey);
-                    node->key = newKey;
-                    node->value = newValue;
-                }
-            } else {
-                treeNode* temp = node->left;
-                node->key = temp ? node->left->key : node->right->key;
-                node->value = temp ? node->left->value : node->right->value;
-                free(temp ? node->left : node->right);
-                node->left = temp ? node->left->left : node->right->left;
-                node->right = temp ? node->left->right : node->right->right;
-            }
-            return;
+            free(node->value);
+            node->value = strdup(value);
+            return 0;
         }
-        prev = node;
         node = (cmp > 0) ? node->left : node->right;
     }
+    node = (treeNode*)malloc(sizeof(treeNode));
+    node->key = strdup(key);
+    node->value = strdup(value);
+    linkTreeNode(tree, node);
+    return 1;
+}
+
+// Returns 1 when the key was found and removed.
+int removeFromTree(Tree* tree, char* key) {
+    int removed = 0;
+    tree->root = removeNode(tree->root, key, &removed);
+    return removed;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Key number i of the flooding set: "Aa" and "BB" hash alike under the polynomial hash,
+// so every string of blocks of them collides with every other one of the same length.
+// Counting in binary produces them in sorted order.
+static void makeCollidingKey(char* key, size_t i, int blocks) {
+    for (int j = 0; j < blocks; j++) {
+        int bit = (i >> (blocks - 1 - j)) & 1;
+        key[2 * j] = bit ? 'B' : 'A';
+        key[2 * j + 1] = bit ? 'B' : 'a';
+    }
+    key[2 * blocks] = 0;
+}
+
+// Adds count sorted colliding keys and looks each up again, first with the old unkeyed
+// hash, which puts them all into one bucket, then with the seeded one.
+void benchmarkFlood(size_t count) {
+    int blocks = 1;
+    while (blocks < 62 && ((size_t)1 << blocks) < count)
+        blocks++;
+    char key[128];
+    for (int keyed = 0; keyed <= 1; keyed++) {
+        hashTable* table = newHashTable(1024);
+        table->keyed = keyed;
+        double start = now();
+        for (size_t i = 0; i < count; i++) {
+            makeCollidingKey(key, i, blocks);
+            addToHashTable(table, key, "x");
+        }
+        double adding = now() - start;
+        size_t hits = 0;
+        start = now();
+        for (size_t i = 0; i < count; i++) {
+            makeCollidingKey(key, i, blocks);
+            hits += getValueForKey(table, key) != NULL;
+        }
+        double finding = now() - start;
+        int tallest = 0;
+        for (size_t i = 0; i < table->size; i++)
+            tallest = (height(table->list[i]->root) > tallest) ? height(table->list[i]->root) : tallest;
+        printf("%s: keys: %lu; buckets: %lu; tallest bucket tree: %d; add: %.1f ns; find: %.1f ns; hits: %lu\n",
+               keyed ? "seeded siphash" : "unkeyed hash", table->used, table->size, tallest,
+               adding * 1e9 / count, finding * 1e9 / count, hits);
+        freeHashTable(table);
+    }
 }
 
 int main(int argc, char** argv) {
@@ -203,6 +411,8 @@ int main(int argc, char** argv) {
          "       r <key> - remove\n" \
          "       f <key> - get value for key\n" \
          "       p - print table\n" \
+         "       c <size> - rehash into size buckets\n" \
+         "       b <count> - time count colliding keys with the unkeyed and the seeded hash\n" \
          "       q - quit");
     while (1) {
         fgets(cmd, maxStringLen-1, stdin);
@@ -238,10 +448,25 @@ int main(int argc, char** argv) {
             case 'q':
                 freeHashTable(table);
                 return 0;
-            case 'c':
-                freeHashTable(table);
-                table = newHashTable(atoi(strtok(NULL, "\n")));
+            case 'c': {
+                char* size = strtok(NULL, "\n");
+                if (!size || atoi(size) <= 0) {
+                    puts("ERROR: size must be positive");
+                    break;
+                }
+                resizeHashTable(table, atoi(size));
+                printHashTable(table);
                 break;
+            }
+            case 'b': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0) {
+                    puts("ERROR: count must be positive");
+                    break;
+                }
+                benchmarkFlood(atol(count));
+                break;
+            }
             default:
                 break;
         }
@@ -1,11 +1,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "output.h"
+#include "frozen.h"
+
+// Counting Bloom filter split into blocks of one cache line. A key touches probes 4-bit
+// counters, all in the block its hash picks, so a check costs a single cache miss. Counters
+// let removes take a key out again; a counter that reaches 15 stays there for good.
+typedef struct {
+    uint64_t* blocks;
+    size_t count;
+    int probes;
+    double rate;
+    size_t lookups;
+    size_t filtered;
+    size_t falsePositives;
+} Filter;
+
+#define BLOCK_WORDS 8
+#define BLOCK_COUNTERS (BLOCK_WORDS * 16)
+#define MAX_PROBES 16
 
 typedef struct table{
     char** key;
     char** value;
     size_t size;
+    Filter* filter;     // NULL when lookups go straight to the table
+    Frozen* frozen;     // while set the entries live there and every slot is empty
 } hashTable;
 
 char tombstone;
@@ -18,6 +43,17 @@ void removeValueForKey(hashTable*, char*);
 const char* getValueForKey(hashTable*, const char*);
 size_t getStringHash(const char*);
 
+Filter* newFilter(size_t, double);
+void freeFilter(Filter*);
+void filterAdd(Filter*, size_t);
+void filterRemove(Filter*, size_t);
+int filterMayContain(Filter*, size_t);
+void setFilter(hashTable*, double);
+void printStats(hashTable*);
+
+Frozen* freezeHashTable(hashTable*);
+int thawHashTable(hashTable*);
+
 hashTable* newHashTable(size_t size) {
     hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
     ret->size = size;
@@ -25,12 +61,14 @@ hashTable* newHashTable(size_t size) {
     for (size_t i = 0; i < size; i++)
         ret->key[i] = NULL;
     ret->value = (char**)malloc(sizeof(char*) * size);
+    ret->filter = NULL;
+    ret->frozen = NULL;
     return ret;
 }
 
 size_t getStringHash(const char* value) {
     size_t hash = 7;
-    for (size_t i = 0; i < strlen(value); i++)
+    for (size_t i = 0; value[i]; i++)
         hash = hash * 31 + value[i];
     return hash;
 }
@@ -41,17 +79,180 @@ void freeHashTable(hashTable* table) {
             free(table->key[i]);
             free(table->value[i]);
         }
+    if (table->filter)
+        freeFilter(table->filter);
+    if (table->frozen)
+        freeFrozen(table->frozen);
+    free(table->key);
+    free(table->value);
     free(table);
 }
 
+void printEntry(Output* out, const char* key, const char* value) {
+    outputString(out, "  key: ");
+    outputString(out, key);
+    outputString(out, "; value: ");
+    outputString(out, value);
+    outputChar(out, '\n');
+}
+
 void printHashTable(hashTable* table) {
+    Output* out = newOutput(STDOUT_FILENO);
+    for (size_t i = 0; i < table->size; i++)
+        if (table->key[i] && table->key[i] != &tombstone)
+            printEntry(out, table->key[i], table->value[i]);
+    for (size_t i = 0; table->frozen && i < table->frozen->count; i++) {
+        const char* key = table->frozen->strings + table->frozen->entry[i].offset;
+        printEntry(out, key, key + strlen(key) + 1);
+    }
+    freeOutput(out);
+}
+
+// Expected false positive rate of a blocked filter with perKey counters per key: the number
+// of keys in a block is Poisson distributed, and full blocks are worse than a plain Bloom
+// filter's average makes up for.
+static double blockedRate(double perKey, int probes) {
+    double keys = BLOCK_COUNTERS / perKey, chance = exp(-keys), ret = 0;
+    for (int j = 0; j < keys + 20 * sqrt(keys) + 20; j++) {
+        ret += chance * pow(1 - pow(1 - 1.0 / BLOCK_COUNTERS, probes * j), probes);
+        chance *= keys / (j + 1);
+    }
+    return ret;
+}
+
+// Sized for keys keys with the fewest counters per key that reach the wanted rate.
+Filter* newFilter(size_t keys, double rate) {
+    Filter* ret = (Filter*)malloc(sizeof(Filter));
+    double perKey = 1;
+    ret->probes = 0;
+    while (!ret->probes && perKey < BLOCK_COUNTERS) {
+        perKey += 0.25;
+        for (int probes = 1; probes <= MAX_PROBES && !ret->probes; probes++)
+            ret->probes = (blockedRate(perKey, probes) <= rate) ? probes : 0;
+    }
+    ret->probes = ret->probes ? ret->probes : MAX_PROBES;
+    ret->count = (size_t)ceil(keys * perKey / BLOCK_COUNTERS);
+    ret->count = ret->count ? ret->count : 1;
+    ret->rate = rate;
+    // Blocks start on a line boundary, otherwise most of them would straddle two lines.
+    ret->blocks = (uint64_t*)aligned_alloc(64, ret->count * BLOCK_WORDS * sizeof(uint64_t));
+    memset(ret->blocks, 0, ret->count * BLOCK_WORDS * sizeof(uint64_t));
+    ret->lookups = ret->filtered = ret->falsePositives = 0;
+    return ret;
+}
+
+void freeFilter(Filter* filter) {
+    free(filter->blocks);
+    free(filter);
+}
+
+// Picks the block of the key and the counters in it. The table hash is mixed as in
+// MurmurHash3 first, since its low bits already pick the slot. Every probe then takes the
+// top bits of the next step of a multiplicative generator: first + i * step patterns would
+// give a block only a few thousand different probe sets, so absent keys would often share
+// one with a present key.
+static uint64_t* findCounters(Filter* filter, size_t hash, unsigned* counters) {
+    uint64_t mixed = hash;
+    mixed ^= mixed >> 33;
+    mixed *= 0xff51afd7ed558ccdull;
+    mixed ^= mixed >> 33;
+    mixed *= 0xc4ceb9fe1a85ec53ull;
+    mixed ^= mixed >> 33;
+    uint64_t state = mixed;
+    for (int i = 0; i < filter->probes; i++) {
+        state = state * 0x5851f42d4c957f2dull + 0x14057b7ef767814full;
+        counters[i] = state >> 57;
+    }
+    return filter->blocks + (mixed & 0xffffffff) % filter->count * BLOCK_WORDS;
+}
+
+static inline unsigned getCounter(uint64_t* block, unsigned counter) {
+    return (block[counter / 16] >> (counter % 16 * 4)) & 15;
+}
+
+void filterAdd(Filter* filter, size_t hash) {
+    unsigned counters[MAX_PROBES];
+    uint64_t* block = findCounters(filter, hash, counters);
+    for (int i = 0; i < filter->probes; i++)
+        if (getCounter(block, counters[i]) != 15)
+            block[counters[i] / 16] += (uint64_t)1 << (counters[i] % 16 * 4);
+}
+
+void filterRemove(Filter* filter, size_t hash) {
+    unsigned counters[MAX_PROBES];
+    uint64_t* block = findCounters(filter, hash, counters);
+    for (int i = 0; i < filter->probes; i++)
+        if (getCounter(block, counters[i]) != 15)
+            block[counters[i] / 16] -= (uint64_t)1 << (counters[i] % 16 * 4);
+}
+
+// 0 means the key is certainly not in the table.
+int filterMayContain(Filter* filter, size_t hash) {
+    unsigned counters[MAX_PROBES];
+    uint64_t* block = findCounters(filter, hash, counters);
+    for (int i = 0; i < filter->probes; i++)
+        if (!getCounter(block, counters[i]))
+            return 0;
+    return 1;
+}
+
+// Replaces the filter with one for the given false positive rate, filled from the keys
+// already in the table. A rate of 0 drops the filter.
+void setFilter(hashTable* table, double rate) {
+    if (table->filter)
+        freeFilter(table->filter);
+    table->filter = NULL;
+    if (rate <= 0)
+        return;
+    table->filter = newFilter(table->size, rate);
     for (size_t i = 0; i < table->size; i++)
         if (table->key[i] && table->key[i] != &tombstone)
-            printf("  key: %s; value: %s\n", table->key[i], table->value[i]);
+            filterAdd(table->filter, getStringHash(table->key[i]));
+}
+
+// Memory of the slot arrays and the strings they point to, and what the filter costs and saves.
+void printStats(hashTable* table) {
+    size_t used = 0, tombstones = 0, strings = 0;
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->key[i] == &tombstone) {
+            tombstones++;
+        } else if (table->key[i]) {
+            used++;
+            strings += strlen(table->key[i]) + strlen(table->value[i]) + 2;
+        }
+    }
+    printf("table: %lu slots; %lu used; %lu tombstones; %lu bytes of slots; %lu bytes of strings\n",
+           table->size, used, tombstones, table->size * 2 * sizeof(char*), strings);
+    Frozen* frozen = table->frozen;
+    if (frozen)
+        printf("frozen: %lu keys; %lu buckets; %lu bytes of slots and pilots; %lu bytes of strings\n",
+               frozen->count, frozen->buckets,
+               frozen->count * sizeof(FrozenEntry) + frozen->buckets * sizeof(uint32_t), frozen->bytes);
+    Filter* filter = table->filter;
+    if (!filter) {
+        puts("filter: off");
+        return;
+    }
+    size_t absent = filter->filtered + filter->falsePositives;
+    printf("filter: rate %g; %d probes; %lu blocks; %lu bytes (%.1f per slot)\n"
+           "lookups: %lu; stopped by filter: %lu; false positives: %lu (%.3g of absent keys)\n",
+           filter->rate, filter->probes, filter->count, filter->count * BLOCK_WORDS * sizeof(uint64_t),
+           (double)filter->count * BLOCK_WORDS * sizeof(uint64_t) / table->size, filter->lookups,
+           filter->filtered, filter->falsePositives, absent ? (double)filter->falsePositives / absent : 0.0);
 }
 
 const char* getValueForKey(hashTable* table, const char* key) {
-    size_t index = getStringHash(key) % table->size;
+    if (table->frozen)
+        return findFrozen(table->frozen, key);
+    size_t hash = getStringHash(key);
+    if (table->filter) {
+        table->filter->lookups++;
+        if (!filterMayContain(table->filter, hash)) {
+            table->filter->filtered++;
+            return NULL;
+        }
+    }
+    size_t index = hash % table->size;
     size_t current = index;
     do {
         if (!table->key[current])
@@ -60,21 +261,22 @@ const char* getValueForKey(hashTable* table, const char* key) {
             return table->value[current];
         current = (current + 1) % table->size;
     } while (current != index);
+    if (table->filter)
+        table->filter->falsePositives++;
     return NULL;
 }
 
+// A new key goes into the first tombstone of its run, but only after the rest of the run
+// has been checked for the key.
 int addValueForKey(hashTable* table, const char* key, const char* value) {
-    size_t index = getStringHash(key) % table->size;
-    size_t current = index;
+    size_t hash = getStringHash(key);
+    size_t index = hash % table->size;
+    size_t current = index, slot = table->size;
     do {
+        if (!table->key[current])
+            break;
         if (table->key[current] == &tombstone) {
-            table->key[current] = strdup(key);
-            table->value[current] = strdup(value);
-            return 0;
-        } else if (!table->key[current]) {
-            table->key[current] = strdup(key);
-            table->value[current] = strdup(value);
-            return 0;
+            slot = (slot == table->size) ? current : slot;
         } else if (!strcmp(key, table->key[current])) {
             free(table->value[current]);
             table->value[current] = strdup(value);
@@ -82,11 +284,21 @@ int addValueForKey(hashTable* table, const char* key, const char* value) {
         }
         current = (current + 1) % table->size;
     } while (current != index);
-    return 1;
+    if (slot == table->size) {
+        if (table->key[current])
+            return 1;
+        slot = current;
+    }
+    table->key[slot] = strdup(key);
+    table->value[slot] = strdup(value);
+    if (table->filter)
+        filterAdd(table->filter, hash);
+    return 0;
 }
 
 void removeValueForKey(hashTable* table, char* key) {
-    size_t index = getStringHash(key) % table->size;
+    size_t hash = getStringHash(key);
+    size_t index = hash % table->size;
     size_t current = index;
     do {
         if (!table->key[current])
@@ -95,12 +307,99 @@ void removeValueForKey(hashTable* table, char* key) {
             free(table->key[current]);
             free(table->value[current]);
             table->key[current] = &tombstone;
+            if (table->filter)
+                filterRemove(table->filter, hash);
             return;
         }
         current = (current + 1) % table->size;
     } while (current != index);
 }
 
+// Moves every entry into a new frozen form. The slots are left empty, tombstones included,
+// and the filter is emptied. Lookups go to the frozen form until the table is thawed.
+Frozen* freezeHashTable(hashTable* table) {
+    char** key = (char**)malloc((table->size + 1) * sizeof(char*));
+    char** value = (char**)malloc((table->size + 1) * sizeof(char*));
+    size_t count = 0;
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->key[i] && table->key[i] != &tombstone) {
+            key[count] = table->key[i];
+            value[count++] = table->value[i];
+        }
+        table->key[i] = NULL;
+    }
+    if (table->filter)
+        setFilter(table, table->filter->rate);
+    Frozen* frozen = freezeEntries(key, value, count);
+    free(key);
+    free(value);
+    return frozen;
+}
+
+// Puts the entries of the frozen form back into the slots. Returns 1 when they do not
+// all fit, the rest are dropped.
+int thawHashTable(hashTable* table) {
+    Frozen* frozen = table->frozen;
+    int overflow = 0;
+    table->frozen = NULL;
+    for (size_t i = 0; i < frozen->count; i++) {
+        const char* key = frozen->strings + frozen->entry[i].offset;
+        overflow |= addValueForKey(table, key, key + strlen(key) + 1);
+    }
+    freeFrozen(frozen);
+    return overflow;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Fills a table to the given load with count keys, then looks up count keys of which nine
+// in ten are absent, first without a filter, then behind one of the given rate and last
+// in the frozen table.
+void benchmarkFilter(size_t count, double rate) {
+    hashTable* table = newHashTable(count + count / 4);
+    char (*strings)[20] = malloc(sizeof(*strings) * count);
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(strings[i], "%016llx", (unsigned long long)state);
+        addValueForKey(table, strings[i], strings[i]);
+    }
+    char key[20];
+    static const char* modes[] = {"without filter", "with filter", "frozen"};
+    for (int mode = 0; mode < 3; mode++) {
+        if (mode < 2)
+            setFilter(table, mode ? rate : 0);
+        else
+            table->frozen = freezeHashTable(table);
+        uint64_t lookup = 0x9e3779b97f4a7c15ull;
+        size_t hits = 0;
+        double start = now();
+        for (size_t i = 0; i < count; i++) {
+            lookup ^= lookup << 13;
+            lookup ^= lookup >> 7;
+            lookup ^= lookup << 17;
+            if (lookup % 10) {
+                sprintf(key, "%016llx", (unsigned long long)lookup);
+                key[0] = 'x';
+                hits += getValueForKey(table, key) != NULL;
+            } else {
+                hits += getValueForKey(table, strings[lookup / 10 % count]) != NULL;
+            }
+        }
+        double elapsed = now() - start;
+        printf("%s: %.1f ns per lookup; hits: %lu\n", modes[mode], elapsed * 1e9 / count, hits);
+    }
+    printStats(table);
+    free(strings);
+    freeHashTable(table);
+}
+
 int main(int argc, char** argv) {
     hashTable* table = newHashTable(10);
     size_t maxStringLen = 256;
@@ -110,9 +409,20 @@ int main(int argc, char** argv) {
              "       r <key> - remove value for key\n" \
              "       f <key> - get value for key\n" \
              "       p - print table\n" \
+             "       l <rate> - check lookups against a filter with false positive rate, 0 for none\n" \
+             "       s - print memory and filter statistics\n" \
+             "       b <count> <rate> - time miss heavy lookups without and with a filter and frozen\n" \
+             "       z - freeze into a read only table with a minimal perfect hash\n" \
+             "       u - thaw a frozen table so it takes writes again\n" \
+             "       w <file> - write the frozen table to file\n" \
+             "       o <file> - load a frozen table from file, replacing the contents\n" \
              "       q - quit");
         fgets(input, maxStringLen-1, stdin);
         char* token = strtok(input, " ");
+        if (table->frozen && input[0] && strchr("ar", input[0])) {
+            puts("ERROR: table is frozen, u to thaw it");
+            continue;
+        }
         switch (input[0]) {
             case 'a': {
                 const char* key = strtok(NULL, " \n");
@@ -145,6 +455,62 @@ int main(int argc, char** argv) {
             case 'p':
                 printHashTable(table);
                 break;
+            case 'l': {
+                char* rate = strtok(NULL, "\n");
+                if (!rate || atof(rate) < 0 || atof(rate) >= 1) {
+                    puts("ERROR: rate must be at least 0 and below 1");
+                    break;
+                }
+                setFilter(table, atof(rate));
+                printStats(table);
+                break;
+            }
+            case 's':
+                printStats(table);
+                break;
+            case 'b': {
+                char* count = strtok(NULL, " \n");
+                char* rate = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0 || !rate || atof(rate) <= 0 || atof(rate) >= 1) {
+                    puts("ERROR: count must be positive and rate between 0 and 1");
+                    break;
+                }
+                benchmarkFilter(atol(count), atof(rate));
+                break;
+            }
+            case 'z':
+                if (!table->frozen)
+                    table->frozen = freezeHashTable(table);
+                printHashTable(table);
+                break;
+            case 'u':
+                if (table->frozen && thawHashTable(table))
+                    puts("ERROR: Unable to add new key value pair, table overflow");
+                printHashTable(table);
+                break;
+            case 'w': {
+                char* path = strtok(NULL, "\n");
+                if (!table->frozen)
+                    puts("ERROR: table is not frozen, z to freeze it");
+                else if (!path || !saveFrozen(table->frozen, path))
+                    puts("ERROR: could not write file");
+                break;
+            }
+            case 'o': {
+                // The table gets room for the keys of the file, so a thaw fits them all.
+                char* path = strtok(NULL, "\n");
+                Frozen* frozen = path ? loadFrozen(path) : NULL;
+                if (!frozen) {
+                    puts("ERROR: could not load file");
+                    break;
+                }
+                size_t size = frozen->count + frozen->count / 4 + 1;
+                freeHashTable(table);
+                table = newHashTable(size > 10 ? size : 10);
+                table->frozen = frozen;
+                printHashTable(table);
+                break;
+            }
             case 'q':
                 freeHashTable(table);
                 return 0;
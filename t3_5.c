@@ -1,11 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "output.h"
+#include "wheel.h"
+
+// Number of lookups getMany keeps in flight.
+#define GROUP 16
+// Most expired entries each add removes, the rest wait for the next one.
+#define EXPIRE_STEP 16
+
+// Entries with a time to live own one of these. It knows the slot of its entry, since a
+// remove can shift entries back, and moves along with the entry when that happens.
+typedef struct {
+    Timer timer;
+    size_t slot;
+} SlotTimer;
 
 typedef struct table{
     char** key;
     char** value;
+    SlotTimer** timer;  // NULL for entries that live until removed
     size_t size;
+    Wheel wheel;
+    uint64_t start;     // time of the table in milliseconds is time since start plus skew
+    uint64_t skew;
+    size_t expired;
 } hashTable;
 
 hashTable* newHashTable(size_t);
@@ -14,7 +36,10 @@ int addValueForKey(hashTable*, const char*, const char*);
 void printHashTable(hashTable*);
 void removeValueForKey(hashTable*, char*);
 const char* getValueForKey(hashTable*, const char*);
+void getMany(hashTable*, const char**, size_t, const char**);
 size_t getStringHash(const char*);
+int setTimeToLive(hashTable*, const char*, uint64_t);
+void expireEntries(hashTable*, size_t);
 
 hashTable* newHashTable(size_t size) {
     hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
@@ -23,12 +48,25 @@ hashTable* newHashTable(size_t size) {
     for (size_t i = 0; i < size; i++)
         ret->key[i] = NULL;
     ret->value = (char**)malloc(sizeof(char*) * size);
+    ret->timer = (SlotTimer**)calloc(size, sizeof(SlotTimer*));
+    ret->start = monotonicMs();
+    ret->skew = 0;
+    ret->expired = 0;
+    initWheel(&ret->wheel, 0);
     return ret;
 }
 
+static inline uint64_t currentTime(hashTable* table) {
+    return monotonicMs() - table->start + table->skew;
+}
+
+static inline int isExpired(hashTable* table, size_t slot, uint64_t now) {
+    return table->timer[slot] && table->timer[slot]->timer.expires <= now;
+}
+
 size_t getStringHash(const char* value) {
     size_t hash = 7;
-    for (size_t i = 0; i < strlen(value); i++)
+    for (size_t i = 0; value[i]; i++)
         hash = hash * 31 + value[i];
     return hash;
 }
@@ -38,33 +76,143 @@ void freeHashTable(hashTable* table) {
         if (table->key[i]) {
             free(table->key[i]);
             free(table->value[i]);
+            free(table->timer[i]);
         }
     }
+    free(table->key);
+    free(table->value);
+    free(table->timer);
     free(table);
 }
 
+// Entries with a time to live show the milliseconds left, 0 once they are due.
 void printHashTable(hashTable* table) {
+    uint64_t now = currentTime(table);
+    Output* out = newOutput(STDOUT_FILENO);
     for (size_t i = 0; i < table->size; i++) {
         if (table->key[i]) {
-            printf("  %lu. key: %s; value: %s\n", i, table->key[i], table->value[i]);
+            outputString(out, "  ");
+            outputUnsigned(out, i);
+            outputString(out, ". key: ");
+            outputString(out, table->key[i]);
+            outputString(out, "; value: ");
+            outputString(out, table->value[i]);
+            if (table->timer[i]) {
+                outputString(out, "; ttl: ");
+                outputUnsigned(out, isExpired(table, i, now) ? 0 : table->timer[i]->timer.expires - now);
+            }
+            outputChar(out, '\n');
         }
     }
+    freeOutput(out);
 }
 
-const char* getValueForKey(hashTable* table, const char* key) {
+// Returns the slot of key, table->size when it is not in the table.
+static size_t findSlot(hashTable* table, const char* key) {
     const size_t index = getStringHash(key) % table->size;
     size_t current = index;
     do {
         if (!table->key[current])
-            return NULL;
+            return table->size;
         if (!strcmp(table->key[current], key))
-            return table->value[current];
+            return current;
         current = (current + 1) % table->size;
     } while (current != index);
-    return NULL;
+    return table->size;
 }
 
+static void removeSlot(hashTable*, size_t);
+
+// An expired entry is removed when a lookup finds it.
+const char* getValueForKey(hashTable* table, const char* key) {
+    size_t slot = findSlot(table, key);
+    if (slot == table->size)
+        return NULL;
+    if (table->timer[slot] && isExpired(table, slot, currentTime(table))) {
+        removeSlot(table, slot);
+        table->expired++;
+        return NULL;
+    }
+    return table->value[slot];
+}
+
+// One lookup of getMany in flight. Every step reads only what the previous step
+// prefetched and prefetches what the next one needs.
+typedef struct {
+    size_t index;
+    size_t home;
+    size_t current;
+    int stage;
+} lookup;
+
+// Lookups in flight point at slots, so getMany leaves expired entries for expireEntries
+// and only reports them as missing.
+
+enum {readSlot, compareKey};
+
+static void startLookup(hashTable* table, lookup* state, const char* key, size_t index) {
+    state->index = index;
+    state->home = state->current = getStringHash(key) % table->size;
+    state->stage = readSlot;
+    __builtin_prefetch(&table->key[state->current]);
+}
+
+// Returns 1 once the lookup has stored its result.
+static int stepLookup(hashTable* table, lookup* state, const char** keys, const char** values, uint64_t now) {
+    if (state->stage == readSlot) {
+        if (!table->key[state->current]) {
+            values[state->index] = NULL;
+            return 1;
+        }
+        __builtin_prefetch(table->key[state->current]);
+        __builtin_prefetch(&table->value[state->current]);
+        state->stage = compareKey;
+        return 0;
+    }
+    if (!strcmp(table->key[state->current], keys[state->index])) {
+        values[state->index] = isExpired(table, state->current, now) ? NULL : table->value[state->current];
+        return 1;
+    }
+    state->current = (state->current + 1) % table->size;
+    if (state->current == state->home) {
+        values[state->index] = NULL;
+        return 1;
+    }
+    __builtin_prefetch(&table->key[state->current]);
+    state->stage = readSlot;
+    return 0;
+}
+
+// Same results as count calls of getValueForKey. Up to GROUP lookups are interleaved,
+// each one taking a step in turn, so their cache misses overlap instead of following
+// one another.
+void getMany(hashTable* table, const char** keys, size_t count, const char** values) {
+    lookup group[GROUP];
+    size_t active = 0, next = 0;
+    uint64_t now = currentTime(table);
+    while (active < GROUP && next < count) {
+        startLookup(table, &group[active], keys[next], next);
+        active++;
+        next++;
+    }
+    while (active) {
+        for (size_t i = 0; i < active;) {
+            if (!stepLookup(table, &group[i], keys, values, now)) {
+                i++;
+            } else if (next < count) {
+                startLookup(table, &group[i], keys[next], next);
+                next++;
+                i++;
+            } else {
+                group[i] = group[--active];
+            }
+        }
+    }
+}
+
+// A new value also drops any time to live the key had.
 int addValueForKey(hashTable* table, const char* key, const char* value) {
+    expireEntries(table, EXPIRE_STEP);
     const size_t index = getStringHash(key) % table->size;
     size_t current = index;
     do {
@@ -72,6 +220,11 @@ int addValueForKey(hashTable* table, const char* key, const char* value) {
             if (!strcmp(table->key[current], key)) {
                 free(table->value[current]);
                 table->value[current] = strdup(value);
+                if (table->timer[current]) {
+                    removeTimer(&table->wheel, &table->timer[current]->timer);
+                    free(table->timer[current]);
+                    table->timer[current] = NULL;
+                }
                 return 0;
             }
         } else {
@@ -84,38 +237,128 @@ int addValueForKey(hashTable* table, const char* key, const char* value) {
     return 1;
 }
 
+// Distance from slot from forward to slot to, wrapping around the end of the table.
 static inline size_t offset(size_t from, size_t to, size_t table_size) {
-    return (from > to) ? table_size - to + from : to - from;
+    return (to >= from) ? to - from : table_size - from + to;
 }
 
-void removeValueForKey(hashTable* table, char* key) {
-    const size_t index = getStringHash(key) % table->size;
-    size_t current = index;
-    do {
-        if (!table->key[current])
-            return;
-        if (table->key[current] && !strcmp(table->key[current], key)) {
-            free(table->key[current]);
-            table->key[current] = NULL;
-            free(table->value[current]);
-            size_t pos = (current + 1) % table->size;
-            size_t first_null = current;
-            do {
-                if (!table->key[pos])
-                    break;
-                const size_t hash = getStringHash(table->key[pos]) % table->size;
-                if ((hash <= first_null && pos >= index) || (offset(first_null, pos, table->size) <= offset(hash, pos, table->size) && pos < index)) {
-                    table->key[first_null] = table->key[pos];
-                    table->value[first_null] = table->value[pos];
-                    table->key[pos] = NULL;
-                    first_null = pos;
-                }
-                pos = (pos + 1) % table->size;
-            } while (pos != current);
-            return;
+// Closes the gap with backward shift instead of a tombstone: every key of the run after
+// the removed one moves back into the hole unless that would put it before its own slot.
+// Timers move with their entries.
+static void removeSlot(hashTable* table, size_t current) {
+    free(table->key[current]);
+    table->key[current] = NULL;
+    free(table->value[current]);
+    if (table->timer[current]) {
+        if (table->timer[current]->timer.link)
+            removeTimer(&table->wheel, &table->timer[current]->timer);
+        free(table->timer[current]);
+        table->timer[current] = NULL;
+    }
+    size_t pos = (current + 1) % table->size;
+    size_t first_null = current;
+    while (table->key[pos]) {
+        const size_t hash = getStringHash(table->key[pos]) % table->size;
+        if (offset(hash, pos, table->size) >= offset(first_null, pos, table->size)) {
+            table->key[first_null] = table->key[pos];
+            table->value[first_null] = table->value[pos];
+            table->timer[first_null] = table->timer[pos];
+            if (table->timer[first_null])
+                table->timer[first_null]->slot = first_null;
+            table->key[pos] = NULL;
+            table->timer[pos] = NULL;
+            first_null = pos;
         }
-        current = (current + 1) % table->size;
-    } while (current != index);
+        pos = (pos + 1) % table->size;
+    }
+}
+
+void removeValueForKey(hashTable* table, char* key) {
+    size_t slot = findSlot(table, key);
+    if (slot != table->size)
+        removeSlot(table, slot);
+}
+
+// The entry expires ttl milliseconds from now, ttl 0 makes it live until removed.
+// Returns 0 when the key is not in the table.
+int setTimeToLive(hashTable* table, const char* key, uint64_t ttl) {
+    size_t slot = findSlot(table, key);
+    uint64_t now = currentTime(table);
+    if (slot == table->size || isExpired(table, slot, now))
+        return 0;
+    SlotTimer* timer = table->timer[slot];
+    if (timer)
+        removeTimer(&table->wheel, &timer->timer);
+    if (!ttl) {
+        free(timer);
+        table->timer[slot] = NULL;
+        return 1;
+    }
+    if (!timer) {
+        timer = (SlotTimer*)malloc(sizeof(SlotTimer));
+        timer->slot = slot;
+        table->timer[slot] = timer;
+    }
+    timer->timer.expires = now + ttl;
+    addTimer(&table->wheel, &timer->timer);
+    return 1;
+}
+
+// Removes at most limit entries whose time to live has run out, oldest deadline first.
+void expireEntries(hashTable* table, size_t limit) {
+    uint64_t now = currentTime(table);
+    Timer* timer;
+    while (limit-- && (timer = nextExpired(&table->wheel, now))) {
+        removeSlot(table, ((SlotTimer*)timer)->slot);
+        table->expired++;
+    }
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Adds count random keys to a table of twice as many slots, then looks up count keys in
+// random order, half of them absent, once with getValueForKey per key and once with getMany.
+void benchmarkGetMany(size_t count) {
+    hashTable* table = newHashTable(count * 2);
+    char (*strings)[20] = malloc(sizeof(*strings) * count * 2);
+    const char** keys = (const char**)malloc(sizeof(char*) * count);
+    const char** values = (const char**)malloc(sizeof(char*) * count);
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < count * 2; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        sprintf(strings[i], "%016llx", (unsigned long long)state);
+        if (i < count)
+            addValueForKey(table, strings[i], strings[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        keys[i] = strings[state % (count * 2)];
+    }
+    size_t hits = 0;
+    double start = now();
+    for (size_t i = 0; i < count; i++)
+        hits += getValueForKey(table, keys[i]) != NULL;
+    double single = now() - start;
+    start = now();
+    getMany(table, keys, count, values);
+    double batched = now() - start;
+    size_t batchHits = 0;
+    for (size_t i = 0; i < count; i++)
+        batchHits += values[i] != NULL;
+    printf("keys: %lu; slots: %lu; getValueForKey: %.1f ns; getMany: %.1f ns; hits: %lu/%lu\n",
+           count, table->size, single * 1e9 / count, batched * 1e9 / count, hits, batchHits);
+    free(values);
+    free(keys);
+    free(strings);
+    freeHashTable(table);
 }
 
 int main(int argc, char** argv) {
@@ -126,7 +369,12 @@ int main(int argc, char** argv) {
         puts("\nusage: a <key> <value> - add value for key\n" \
              "       r <key> - remove value for key\n" \
              "       f <key> - get value for key\n" \
+             "       m <key> <key> ... - get values for several keys in one batch\n" \
              "       p - print table\n" \
+             "       b <count> - time count single and batched lookups\n" \
+             "       e <key> <ms> - let key expire after ms milliseconds, 0 to keep it\n" \
+             "       t <ms> - move the clock of the table ms milliseconds ahead\n" \
+             "       x - remove every expired entry\n" \
              "       q - quit");
         fgets(input, maxStringLen-1, stdin);
         char* token = strtok(input, " ");
@@ -159,9 +407,60 @@ int main(int argc, char** argv) {
                     printf("ERROR: value for key %s not found\n", key);
                 break;
             }
+            case 'm': {
+                const char* keys[maxStringLen / 2];
+                const char* values[maxStringLen / 2];
+                size_t count = 0;
+                char* key;
+                while ((key = strtok(NULL, " \n")))
+                    keys[count++] = key;
+                getMany(table, keys, count, values);
+                for (size_t i = 0; i < count; i++) {
+                    if (values[i])
+                        printf("value for key %s: %s\n", keys[i], values[i]);
+                    else
+                        printf("ERROR: value for key %s not found\n", keys[i]);
+                }
+                break;
+            }
             case 'p':
                 printHashTable(table);
                 break;
+            case 'b': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0) {
+                    puts("ERROR: count must be positive");
+                    break;
+                }
+                benchmarkGetMany(atol(count));
+                break;
+            }
+            case 'e': {
+                const char* key = strtok(NULL, " \n");
+                const char* ttl = strtok(NULL, "\n");
+                if (!key || !ttl || atol(ttl) < 0) {
+                    puts("ERROR: usage e <key> <ms>");
+                    break;
+                }
+                if (!setTimeToLive(table, key, atol(ttl)))
+                    printf("ERROR: value for key %s not found\n", key);
+                else
+                    printHashTable(table);
+                break;
+            }
+            case 't': {
+                const char* ms = strtok(NULL, "\n");
+                if (!ms || atol(ms) < 0) {
+                    puts("ERROR: ms must not be negative");
+                    break;
+                }
+                table->skew += atol(ms);
+                break;
+            }
+            case 'x':
+                expireEntries(table, SIZE_MAX);
+                printHashTable(table);
+                break;
             case 'q':
                 freeHashTable(table);
                 return 0;
@@ -0,0 +1,562 @@
+// Hash table, collision resolved by separate chaining using array lists that turn into
+// AVL trees when they get long.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "output.h"
+
+// By default a table doubles once it holds more than MAX_LOAD entries per bucket on average.
+#define MAX_LOAD 2
+// A bucket becomes a tree when an add would make its array longer than TREEIFY and goes
+// back to an array once removes leave UNTREEIFY entries. The gap keeps a bucket that sits
+// at the threshold from switching on every add and remove.
+#define TREEIFY 8
+#define UNTREEIFY 6
+#define TREE_BUCKET UINT32_MAX
+
+typedef struct {
+    uint64_t hash;
+    char* key;
+    char* value;
+} entry;
+
+typedef struct treeNode {
+    entry item;
+    struct treeNode* left;
+    struct treeNode* right;
+    int height;
+} treeNode;
+
+// Buckets sit by value in the table. An array bucket holds count entries in room for
+// capacity, a tree bucket has capacity TREE_BUCKET. Empty buckets own no memory.
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    union {
+        entry* entries;
+        treeNode* root;
+    };
+} Bucket;
+
+typedef struct {
+    Bucket* list;
+    size_t size;
+    size_t used;
+    size_t maxLoad;     // 0 keeps the size fixed
+    int trees;          // 0 keeps every bucket an array
+} hashTable;
+
+hashTable* newHashTable(size_t);
+void freeHashTable(hashTable*);
+void addToHashTable(hashTable*, char*, char*);
+void resizeHashTable(hashTable*, size_t);
+void printHashTable(hashTable*);
+void printStats(hashTable*);
+void removeValueForKey(hashTable*, char*);
+const char* getValueForKey(hashTable*, char*);
+uint64_t getStringHash(const char*);
+
+void freeBucket(Bucket*);
+entry* findInBucket(Bucket*, const char*, uint64_t);
+void linkEntry(hashTable*, Bucket*, entry);
+int removeFromBucket(Bucket*, const char*, uint64_t);
+void treeifyBucket(Bucket*);
+void untreeifyBucket(Bucket*);
+
+static inline int isTree(Bucket* bucket) {
+    return bucket->capacity == TREE_BUCKET;
+}
+
+hashTable* newHashTable(size_t size) {
+    hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
+    ret->size = size;
+    ret->list = (Bucket*)calloc(ret->size, sizeof(Bucket));
+    ret->used = 0;
+    ret->maxLoad = MAX_LOAD;
+    ret->trees = 1;
+    return ret;
+}
+
+uint64_t getStringHash(const char* value) {
+    uint64_t hash = 7;
+    for (size_t i = 0; value[i]; i++)
+        hash = hash * 31 + value[i];
+    return hash;
+}
+
+static void freeTreeNode(treeNode* node) {
+    free(node->item.key);
+    free(node->item.value);
+    if (node->left)
+        freeTreeNode(node->left);
+    if (node->right)
+        freeTreeNode(node->right);
+    free(node);
+}
+
+void freeBucket(Bucket* bucket) {
+    if (isTree(bucket)) {
+        freeTreeNode(bucket->root);
+        return;
+    }
+    for (uint32_t i = 0; i < bucket->count; i++) {
+        free(bucket->entries[i].key);
+        free(bucket->entries[i].value);
+    }
+    free(bucket->entries);
+}
+
+void freeHashTable(hashTable* table) {
+    for (size_t i = 0; i < table->size; i++)
+        freeBucket(&table->list[i]);
+    free(table->list);
+    free(table);
+}
+
+void printEntry(Output* out, const char* key, const char* value) {
+    outputString(out, "  key: ");
+    outputString(out, key);
+    outputString(out, "; value: ");
+    outputString(out, value);
+    outputChar(out, '\n');
+}
+
+static void printTreeNode(Output* out, treeNode* node) {
+    if (node->left)
+        printTreeNode(out, node->left);
+    printEntry(out, node->item.key, node->item.value);
+    if (node->right)
+        printTreeNode(out, node->right);
+}
+
+void printHashTable(hashTable* table) {
+    Output* out = newOutput(STDOUT_FILENO);
+    outputString(out, "table size: ");
+    outputUnsigned(out, table->size);
+    outputString(out, "; used: ");
+    outputUnsigned(out, table->used);
+    outputString(out, ";\n");
+    for (size_t i = 0; i < table->size; i++) {
+        Bucket* bucket = &table->list[i];
+        outputString(out, "hash: ");
+        outputUnsigned(out, i);
+        outputString(out, isTree(bucket) ? " (tree)\n" : "\n");
+        if (isTree(bucket)) {
+            printTreeNode(out, bucket->root);
+        } else {
+            for (uint32_t j = 0; j < bucket->count; j++)
+                printEntry(out, bucket->entries[j].key, bucket->entries[j].value);
+        }
+    }
+    freeOutput(out);
+}
+
+static inline int height(treeNode* node) {
+    return node ? node->height : 0;
+}
+
+// Counts both kinds of bucket and the bytes they hold, not counting the key and value strings.
+void printStats(hashTable* table) {
+    size_t arrays = 0, trees = 0, longest = 0, bytes = table->size * sizeof(Bucket);
+    int tallest = 0;
+    for (size_t i = 0; i < table->size; i++) {
+        Bucket* bucket = &table->list[i];
+        longest = (bucket->count > longest) ? bucket->count : longest;
+        if (isTree(bucket)) {
+            trees++;
+            bytes += bucket->count * sizeof(treeNode);
+            tallest = (height(bucket->root) > tallest) ? height(bucket->root) : tallest;
+        } else if (bucket->count) {
+            arrays++;
+            bytes += bucket->capacity * sizeof(entry);
+        }
+    }
+    printf("keys: %lu; buckets: %lu; arrays: %lu; trees: %lu; longest bucket: %lu; tallest tree: %d; "
+           "bytes: %lu (%.1f per key)\n", table->used, table->size, arrays, trees, longest, tallest,
+           bytes, table->used ? (double)bytes / table->used : 0.0);
+}
+
+// Trees are ordered by hash first, so most steps cost an integer compare and strcmp only
+// runs between keys whose whole hash collides.
+static inline int compareEntry(uint64_t hash, const char* key, const entry* item) {
+    if (hash != item->hash)
+        return (hash < item->hash) ? -1 : 1;
+    return strcmp(key, item->key);
+}
+
+entry* findInBucket(Bucket* bucket, const char* key, uint64_t hash) {
+    if (isTree(bucket)) {
+        treeNode* node = bucket->root;
+        while (node) {
+            int cmp = compareEntry(hash, key, &node->item);
+            if (!cmp)
+                return &node->item;
+            node = (cmp < 0) ? node->left : node->right;
+        }
+        return NULL;
+    }
+    for (uint32_t i = 0; i < bucket->count; i++) {
+        if (bucket->entries[i].hash == hash && !strcmp(bucket->entries[i].key, key))
+            return &bucket->entries[i];
+    }
+    return NULL;
+}
+
+const char* getValueForKey(hashTable* table, char* key) {
+    uint64_t hash = getStringHash(key);
+    entry* item = findInBucket(&table->list[hash % table->size], key, hash);
+    return item ? item->value : NULL;
+}
+
+void addToHashTable(hashTable* table, char* key, char* value) {
+    uint64_t hash = getStringHash(key);
+    Bucket* bucket = &table->list[hash % table->size];
+    entry* item = findInBucket(bucket, key, hash);
+    if (item) {
+        free(item->value);
+        item->value = strdup(value);
+        return;
+    }
+    linkEntry(table, bucket, (entry){hash, strdup(key), strdup(value)});
+    table->used++;
+    if (table->maxLoad && table->used > table->size * table->maxLoad)
+        resizeHashTable(table, table->size * 2);
+}
+
+void removeValueForKey(hashTable* table, char* key) {
+    uint64_t hash = getStringHash(key);
+    table->used -= removeFromBucket(&table->list[hash % table->size], key, hash);
+}
+
+static void moveTreeNode(hashTable* table, Bucket* lists, size_t size, treeNode* node) {
+    if (node->left)
+        moveTreeNode(table, lists, size, node->left);
+    if (node->right)
+        moveTreeNode(table, lists, size, node->right);
+    linkEntry(table, &lists[node->item.hash % size], node->item);
+    free(node);
+}
+
+// Moves every entry into size new buckets using the stored hash. The new buckets pick
+// their own form, so a tree whose keys spread out comes back as arrays.
+void resizeHashTable(hashTable* table, size_t size) {
+    Bucket* lists = (Bucket*)calloc(size, sizeof(Bucket));
+    for (size_t i = 0; i < table->size; i++) {
+        Bucket* bucket = &table->list[i];
+        if (isTree(bucket)) {
+            moveTreeNode(table, lists, size, bucket->root);
+            continue;
+        }
+        for (uint32_t j = 0; j < bucket->count; j++)
+            linkEntry(table, &lists[bucket->entries[j].hash % size], bucket->entries[j]);
+        free(bucket->entries);
+    }
+    free(table->list);
+    table->list = lists;
+    table->size = size;
+}
+
+static void updateHeight(treeNode* node) {
+    int left = height(node->left), right = height(node->right);
+    node->height = ((left > right) ? left : right) + 1;
+}
+
+static treeNode* rotateLeft(treeNode* node) {
+    treeNode* right = node->right;
+    node->right = right->left;
+    right->left = node;
+    updateHeight(node);
+    updateHeight(right);
+    return right;
+}
+
+static treeNode* rotateRight(treeNode* node) {
+    treeNode* left = node->left;
+    node->left = left->right;
+    left->right = node;
+    updateHeight(node);
+    updateHeight(left);
+    return left;
+}
+
+// Restores the AVL condition at node after one of its subtrees changed height by one,
+// returns the new root of the subtree.
+static treeNode* balance(treeNode* node) {
+    updateHeight(node);
+    int factor = height(node->left) - height(node->right);
+    if (factor > 1) {
+        if (height(node->left->left) < height(node->left->right))
+            node->left = rotateLeft(node->left);
+        return rotateRight(node);
+    }
+    if (factor < -1) {
+        if (height(node->right->right) < height(node->right->left))
+            node->right = rotateRight(node->right);
+        return rotateLeft(node);
+    }
+    return node;
+}
+
+// The key of node must not be in the subtree yet.
+static treeNode* insertNode(treeNode* root, treeNode* node) {
+    if (!root)
+        return node;
+    if (compareEntry(node->item.hash, node->item.key, &root->item) < 0)
+        root->left = insertNode(root->left, node);
+    else
+        root->right = insertNode(root->right, node);
+    return balance(root);
+}
+
+static treeNode* removeMin(treeNode* root, treeNode** min) {
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+    root->left = removeMin(root->left, min);
+    return balance(root);
+}
+
+static treeNode* removeNode(treeNode* root, const char* key, uint64_t hash, int* removed) {
+    if (!root)
+        return NULL;
+    int cmp = compareEntry(hash, key, &root->item);
+    if (cmp < 0) {
+        root->left = removeNode(root->left, key, hash, removed);
+    } else if (cmp > 0) {
+        root->right = removeNode(root->right, key, hash, removed);
+    } else {
+        treeNode* left = root->left;
+        treeNode* right = root->right;
+        free(root->item.key);
+        free(root->item.value);
+        free(root);
+        *removed = 1;
+        if (!right)
+            return left;
+        treeNode* min;
+        right = removeMin(right, &min);
+        min->left = left;
+        min->right = right;
+        return balance(min);
+    }
+    return balance(root);
+}
+
+static treeNode* newTreeNode(entry item) {
+    treeNode* node = (treeNode*)malloc(sizeof(treeNode));
+    node->item = item;
+    node->left = node->right = NULL;
+    node->height = 1;
+    return node;
+}
+
+// Adds an entry whose key is not in the bucket yet, the strings now belong to the bucket.
+void linkEntry(hashTable* table, Bucket* bucket, entry item) {
+    if (!isTree(bucket) && bucket->count == TREEIFY && table->trees)
+        treeifyBucket(bucket);
+    if (isTree(bucket)) {
+        bucket->root = insertNode(bucket->root, newTreeNode(item));
+        bucket->count++;
+        return;
+    }
+    if (bucket->count == bucket->capacity) {
+        bucket->capacity = bucket->capacity ? bucket->capacity * 2 : 1;
+        bucket->entries = (entry*)realloc(bucket->entries, sizeof(entry) * bucket->capacity);
+    }
+    bucket->entries[bucket->count++] = item;
+}
+
+// Returns 1 when the key was found and removed.
+int removeFromBucket(Bucket* bucket, const char* key, uint64_t hash) {
+    if (isTree(bucket)) {
+        int removed = 0;
+        bucket->root = removeNode(bucket->root, key, hash, &removed);
+        bucket->count -= removed;
+        if (bucket->count <= UNTREEIFY)
+            untreeifyBucket(bucket);
+        return removed;
+    }
+    entry* item = findInBucket(bucket, key, hash);
+    if (!item)
+        return 0;
+    free(item->key);
+    free(item->value);
+    memmove(item, item + 1, (char*)(bucket->entries + bucket->count) - (char*)(item + 1));
+    if (!--bucket->count) {
+        free(bucket->entries);
+        bucket->entries = NULL;
+        bucket->capacity = 0;
+    }
+    return 1;
+}
+
+void treeifyBucket(Bucket* bucket) {
+    treeNode* root = NULL;
+    for (uint32_t i = 0; i < bucket->count; i++)
+        root = insertNode(root, newTreeNode(bucket->entries[i]));
+    free(bucket->entries);
+    bucket->root = root;
+    bucket->capacity = TREE_BUCKET;
+}
+
+static void collectTreeNode(treeNode* node, entry* entries, uint32_t* count) {
+    if (node->left)
+        collectTreeNode(node->left, entries, count);
+    entries[(*count)++] = node->item;
+    if (node->right)
+        collectTreeNode(node->right, entries, count);
+    free(node);
+}
+
+// Turns a tree bucket back into an array, entries keep the tree order.
+void untreeifyBucket(Bucket* bucket) {
+    treeNode* root = bucket->root;
+    uint32_t capacity = 0, count = 0;
+    entry* entries = NULL;
+    if (bucket->count) {
+        capacity = 1;
+        while (capacity < bucket->count)
+            capacity *= 2;
+        entries = (entry*)malloc(sizeof(entry) * capacity);
+        collectTreeNode(root, entries, &count);
+    }
+    bucket->entries = entries;
+    bucket->capacity = capacity;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Key number i of a set whose keys all share one hash: "Aa" and "BB" hash alike, so every
+// string of blocks of them collides with every other one of the same length.
+static void makeCollidingKey(char* key, size_t i, int blocks) {
+    for (int j = 0; j < blocks; j++) {
+        int bit = (i >> (blocks - 1 - j)) & 1;
+        key[2 * j] = bit ? 'B' : 'A';
+        key[2 * j + 1] = bit ? 'B' : 'a';
+    }
+    key[2 * blocks] = 0;
+}
+
+// Adds count colliding keys to a fixed size table and looks each up again, first with
+// array buckets only and then with long buckets turned into trees. A few random keys
+// fill the other buckets, so the memory figure also shows the common short bucket.
+void benchmarkSkew(size_t count) {
+    int blocks = 1;
+    while (blocks < 62 && ((size_t)1 << blocks) < count)
+        blocks++;
+    char key[128];
+    for (int trees = 0; trees <= 1; trees++) {
+        hashTable* table = newHashTable(1024);
+        table->maxLoad = 0;
+        table->trees = trees;
+        uint64_t state = 88172645463325252ull;
+        for (size_t i = 0; i < 2 * table->size; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            sprintf(key, "%016llx", (unsigned long long)state);
+            addToHashTable(table, key, "x");
+        }
+        double start = now();
+        for (size_t i = 0; i < count; i++) {
+            makeCollidingKey(key, i, blocks);
+            addToHashTable(table, key, "x");
+        }
+        double adding = now() - start;
+        size_t hits = 0;
+        start = now();
+        for (size_t i = 0; i < count; i++) {
+            makeCollidingKey(key, i, blocks);
+            hits += getValueForKey(table, key) != NULL;
+        }
+        double finding = now() - start;
+        printf("%s: add: %.1f ns; find: %.1f ns; hits: %lu\n  ", trees ? "arrays and trees" : "arrays only",
+               adding * 1e9 / count, finding * 1e9 / count, hits);
+        printStats(table);
+        freeHashTable(table);
+    }
+}
+
+int main(int argc, char** argv) {
+    hashTable* table = newHashTable(2);
+    size_t maxStringLen = (argc == 2) ? atoi(argv[1]) : 256;
+    char cmd[maxStringLen];
+    puts("usage: a <key> <value> - add\n" \
+         "       r <key> - remove\n" \
+         "       f <key> - get value for key\n" \
+         "       p - print table\n" \
+         "       s - print bucket statistics\n" \
+         "       c <size> - rehash into size buckets\n" \
+         "       b <count> - time count colliding keys in array and tree buckets\n" \
+         "       q - quit");
+    while (1) {
+        memset(cmd, 0, maxStringLen);
+        fgets(cmd, maxStringLen-1, stdin);
+        strtok(cmd, " ");
+        switch (cmd[0]) {
+            case 'a': {
+                char* key = strtok(NULL, " \n");
+                key = key ? key : "";
+                char* value = strtok(NULL, "\n");
+                value = value ? value : "";
+                addToHashTable(table, key, value);
+                printHashTable(table);
+                break;
+            }
+            case 'r': {
+                char* key = strtok(NULL, "\n");
+                key = key ? key : "";
+                removeValueForKey(table, key);
+                printHashTable(table);
+                break;
+            }
+            case 'f': {
+                char* key = strtok(NULL, "\n");
+                key = key ? key : "";
+                const char* value = getValueForKey(table, key);
+                value = value ? value : "Not Found";
+                printf("%s\n", value);
+                break;
+            }
+            case 'p':
+                printHashTable(table);
+                break;
+            case 's':
+                printStats(table);
+                break;
+            case 'c': {
+                char* size = strtok(NULL, "\n");
+                if (!size || atoi(size) <= 0) {
+                    puts("ERROR: size must be positive");
+                    break;
+                }
+                resizeHashTable(table, atoi(size));
+                printHashTable(table);
+                break;
+            }
+            case 'b': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) <= 0) {
+                    puts("ERROR: count must be positive");
+                    break;
+                }
+                benchmarkSkew(atol(count));
+                break;
+            }
+            case 'q':
+                freeHashTable(table);
+                return 0;
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,359 @@
+// Hash table, collision resolved by bucketized cuckoo hashing. Every key has two candidate
+// buckets of SLOTS slots each, so a lookup reads at most two buckets at any load.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "output.h"
+
+#define SLOTS 4
+// An add into two full buckets searches breadth first for a chain of at most MAX_DEPTH
+// moves that ends in a free slot, looking at no more than MAX_SEARCH buckets.
+#define MAX_DEPTH 5
+#define MAX_SEARCH 2048
+
+// An empty slot has a NULL key. The hash of every key is kept next to it, so the lookup
+// only compares strings whose hash matches and a move finds the other bucket without
+// hashing the string again.
+typedef struct {
+    uint32_t hash[SLOTS];
+    char* key[SLOTS];
+    char* value[SLOTS];
+} Bucket;
+
+typedef struct table{
+    Bucket* buckets;
+    size_t size;
+    size_t used;
+} hashTable;
+
+// One bucket visited by the search, reached by moving the key in slot of parent.
+typedef struct {
+    size_t bucket;
+    int parent;
+    int slot;
+    int depth;
+} step;
+
+hashTable* newHashTable(size_t);
+void freeHashTable(hashTable*);
+int addValueForKey(hashTable*, const char*, const char*);
+void printHashTable(hashTable*);
+void removeValueForKey(hashTable*, char*);
+const char* getValueForKey(hashTable*, const char*);
+uint32_t getStringHash(const char*);
+
+hashTable* newHashTable(size_t size) {
+    hashTable* ret = (hashTable*)malloc(sizeof(hashTable));
+    ret->size = size;
+    ret->buckets = (Bucket*)calloc(size, sizeof(Bucket));
+    ret->used = 0;
+    return ret;
+}
+
+// The polynomial leaves short keys poorly mixed, so it is finished as in MurmurHash3.
+uint32_t getStringHash(const char* value) {
+    uint64_t hash = 7;
+    for (size_t i = 0; value[i]; i++)
+        hash = hash * 31 + value[i];
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+
+static inline size_t firstBucket(hashTable* table, uint32_t hash) {
+    return hash % table->size;
+}
+
+// The second index comes from a bijective remix of the hash, so it is independent of the
+// first, and is bumped when both land on the same bucket.
+static inline size_t secondBucket(hashTable* table, uint32_t hash) {
+    uint32_t mixed = hash ^ (hash >> 16);
+    mixed *= 0x85ebca6bu;
+    mixed ^= mixed >> 13;
+    mixed *= 0xc2b2ae35u;
+    mixed ^= mixed >> 16;
+    size_t ret = mixed % table->size;
+    return (ret == firstBucket(table, hash)) ? (ret + 1) % table->size : ret;
+}
+
+static inline size_t otherBucket(hashTable* table, size_t bucket, uint32_t hash) {
+    size_t first = firstBucket(table, hash);
+    return (bucket == first) ? secondBucket(table, hash) : first;
+}
+
+void freeHashTable(hashTable* table) {
+    for (size_t i = 0; i < table->size; i++) {
+        for (int j = 0; j < SLOTS; j++) {
+            if (table->buckets[i].key[j]) {
+                free(table->buckets[i].key[j]);
+                free(table->buckets[i].value[j]);
+            }
+        }
+    }
+    free(table->buckets);
+    free(table);
+}
+
+void printHashTable(hashTable* table) {
+    Output* out = newOutput(STDOUT_FILENO);
+    for (size_t i = 0; i < table->size; i++) {
+        for (int j = 0; j < SLOTS; j++) {
+            if (table->buckets[i].key[j]) {
+                outputString(out, "  ");
+                outputUnsigned(out, i * SLOTS + j);
+                outputString(out, ". key: ");
+                outputString(out, table->buckets[i].key[j]);
+                outputString(out, "; value: ");
+                outputString(out, table->buckets[i].value[j]);
+                outputChar(out, '\n');
+            }
+        }
+    }
+    freeOutput(out);
+}
+
+static inline int findSlot(Bucket* bucket, const char* key, uint32_t hash) {
+    for (int i = 0; i < SLOTS; i++) {
+        if (bucket->hash[i] == hash && bucket->key[i] && !strcmp(bucket->key[i], key))
+            return i;
+    }
+    return -1;
+}
+
+static inline int emptySlot(Bucket* bucket) {
+    for (int i = 0; i < SLOTS; i++) {
+        if (!bucket->key[i])
+            return i;
+    }
+    return -1;
+}
+
+const char* getValueForKey(hashTable* table, const char* key) {
+    uint32_t hash = getStringHash(key);
+    Bucket* first = &table->buckets[firstBucket(table, hash)];
+    Bucket* second = &table->buckets[secondBucket(table, hash)];
+    __builtin_prefetch(second);
+    int slot = findSlot(first, key, hash);
+    if (slot >= 0)
+        return first->value[slot];
+    slot = findSlot(second, key, hash);
+    return (slot >= 0) ? second->value[slot] : NULL;
+}
+
+// A bucket is not queued again below itself, so the moves along one chain never touch the
+// same bucket twice.
+static int onPath(step* queue, int index, size_t bucket) {
+    for (; index >= 0; index = queue[index].parent) {
+        if (queue[index].bucket == bucket)
+            return 1;
+    }
+    return 0;
+}
+
+// Returns the index of the queued bucket with a free slot, or -1 when there is none
+// within reach. Breadth first finds the shortest chain of moves.
+static int searchPath(hashTable* table, step* queue, size_t first, size_t second) {
+    int head = 0, tail = 0;
+    queue[tail++] = (step){first, -1, -1, 0};
+    queue[tail++] = (step){second, -1, -1, 0};
+    for (; head < tail; head++) {
+        Bucket* bucket = &table->buckets[queue[head].bucket];
+        if (emptySlot(bucket) >= 0)
+            return head;
+        if (queue[head].depth == MAX_DEPTH)
+            continue;
+        for (int i = 0; i < SLOTS && tail < MAX_SEARCH; i++) {
+            size_t next = otherBucket(table, queue[head].bucket, bucket->hash[i]);
+            if (!onPath(queue, head, next))
+                queue[tail++] = (step){next, head, i, queue[head].depth + 1};
+        }
+    }
+    return -1;
+}
+
+// Walks the chain back from its free slot, each key moving to its other bucket into the
+// slot the previous move freed. Returns the bucket at the start, which now has a free slot.
+static size_t movePath(hashTable* table, step* queue, int index) {
+    while (queue[index].parent >= 0) {
+        Bucket* to = &table->buckets[queue[index].bucket];
+        Bucket* from = &table->buckets[queue[queue[index].parent].bucket];
+        int slot = queue[index].slot, empty = emptySlot(to);
+        to->hash[empty] = from->hash[slot];
+        to->key[empty] = from->key[slot];
+        to->value[empty] = from->value[slot];
+        from->key[slot] = NULL;
+        index = queue[index].parent;
+    }
+    return queue[index].bucket;
+}
+
+// Returns 1 when both buckets are full and no chain of moves frees a slot.
+int addValueForKey(hashTable* table, const char* key, const char* value) {
+    uint32_t hash = getStringHash(key);
+    size_t first = firstBucket(table, hash), second = secondBucket(table, hash);
+    Bucket* buckets[2] = {&table->buckets[first], &table->buckets[second]};
+    for (int i = 0; i < 2; i++) {
+        int slot = findSlot(buckets[i], key, hash);
+        if (slot >= 0) {
+            free(buckets[i]->value[slot]);
+            buckets[i]->value[slot] = strdup(value);
+            return 0;
+        }
+    }
+    Bucket* bucket = (emptySlot(buckets[0]) >= 0) ? buckets[0] : buckets[1];
+    if (emptySlot(bucket) < 0) {
+        step queue[MAX_SEARCH];
+        int found = searchPath(table, queue, first, second);
+        if (found < 0)
+            return 1;
+        bucket = &table->buckets[movePath(table, queue, found)];
+    }
+    int slot = emptySlot(bucket);
+    bucket->hash[slot] = hash;
+    bucket->key[slot] = strdup(key);
+    bucket->value[slot] = strdup(value);
+    table->used++;
+    return 0;
+}
+
+void removeValueForKey(hashTable* table, char* key) {
+    uint32_t hash = getStringHash(key);
+    Bucket* buckets[2] = {&table->buckets[firstBucket(table, hash)], &table->buckets[secondBucket(table, hash)]};
+    for (int i = 0; i < 2; i++) {
+        int slot = findSlot(buckets[i], key, hash);
+        if (slot >= 0) {
+            free(buckets[i]->key[slot]);
+            free(buckets[i]->value[slot]);
+            buckets[i]->key[slot] = NULL;
+            table->used--;
+            return;
+        }
+    }
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void makeKey(char* key, uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    sprintf(key, "%016llx", (unsigned long long)*state);
+}
+
+// Fills a table with room for count keys to 90% and times lookups of present and absent
+// keys there, then keeps adding until the first add fails.
+void benchmarkLoad(size_t count) {
+    hashTable* table = newHashTable((count + SLOTS - 1) / SLOTS);
+    size_t slots = table->size * SLOTS, target = slots * 9 / 10;
+    char key[32];
+    uint64_t state = 88172645463325252ull;
+    double start = now();
+    while (table->used < target) {
+        makeKey(key, &state);
+        if (addValueForKey(table, key, "x"))
+            break;
+    }
+    double adding = now() - start;
+    size_t added = table->used, hits = 0;
+    state = 88172645463325252ull;
+    start = now();
+    for (size_t i = 0; i < added; i++) {
+        makeKey(key, &state);
+        hits += getValueForKey(table, key) != NULL;
+    }
+    double finding = now() - start;
+    uint64_t missState = 0x9e3779b97f4a7c15ull;
+    start = now();
+    for (size_t i = 0; i < added; i++) {
+        makeKey(key, &missState);
+        key[0] = 'x';
+        hits += getValueForKey(table, key) != NULL;
+    }
+    double missing = now() - start;
+    state = 0x2545f4914f6cdd1dull;
+    while (1) {
+        makeKey(key, &state);
+        key[0] = 'y';
+        if (addValueForKey(table, key, "x"))
+            break;
+    }
+    printf("slots: %lu; keys at 90%%: %lu; add: %.1f ns; hit: %.1f ns; miss: %.1f ns; found: %lu\n"
+           "first failed add at load %.1f%%; bucket: %lu bytes; %.1f bytes per slot\n",
+           slots, added, adding * 1e9 / added, finding * 1e9 / added, missing * 1e9 / added, hits,
+           100.0 * table->used / slots, sizeof(Bucket), (double)sizeof(Bucket) / SLOTS);
+    freeHashTable(table);
+}
+
+int main(int argc, char** argv) {
+    hashTable* table = newHashTable(3);
+    size_t maxStringLen = 256;
+    char input[maxStringLen];
+    while (1) {
+        puts("\nusage: a <key> <value> - add value for key\n" \
+             "       r <key> - remove value for key\n" \
+             "       f <key> - get value for key\n" \
+             "       p - print table\n" \
+             "       b <count> - time lookups at 90% load in a table of count slots\n" \
+             "       q - quit");
+        fgets(input, maxStringLen-1, stdin);
+        strtok(input, " ");
+        switch (input[0]) {
+            case 'a': {
+                const char* key = strtok(NULL, " \n");
+                key = key ? key : "";
+                const char* value = strtok(NULL, "\n");
+                value = value ? value : "";
+                if (addValueForKey(table, key, value))
+                    puts("ERROR: Unable to add new key value pair, table overflow");
+                else
+                    printHashTable(table);
+                break;
+            }
+            case 'r': {
+                char* key = strtok(NULL, "\n");
+                key = key ? key : "";
+                removeValueForKey(table, key);
+                printHashTable(table);
+                break;
+            }
+            case 'f': {
+                const char* key = strtok(NULL, "\n");
+                key = key ? key : "";
+                const char* value = getValueForKey(table, key);
+                if (value)
+                    printf("value for key %s: %s\n", key, value);
+                else
+                    printf("ERROR: value for key %s not found\n", key);
+                break;
+            }
+            case 'p':
+                printHashTable(table);
+                break;
+            case 'b': {
+                char* count = strtok(NULL, "\n");
+                if (!count || atol(count) < SLOTS) {
+                    puts("ERROR: count must be at least 4");
+                    break;
+                }
+                benchmarkLoad(atol(count));
+                break;
+            }
+            case 'q':
+                freeHashTable(table);
+                return 0;
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+// Hierarchical timing wheel for expiring table entries. Level 0 has one slot per tick,
+// every level above covers WHEEL_SLOTS times the span of the one below. When a level
+// wraps around, the next slot of the level above is spread out over the levels below,
+// so a timer is moved at most once per level and expiring costs O(expired) instead of
+// a scan of the table.
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// WHEEL_SLOTS must stay 64, level 0 keeps one bit per slot in a word.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// Embedded in whatever expires. link points at the pointer that points at the timer,
+// NULL while the timer is not in a wheel.
+typedef struct timer {
+    uint64_t expires;
+    struct timer* next;
+    struct timer** link;
+} Timer;
+
+// now is the last tick whose level 0 slot has been reached. A set bit in occupied means the
+// level 0 slot may hold timers, bits are cleared once the slot is found empty.
+typedef struct {
+    Timer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied;
+    uint64_t now;
+    size_t count;
+} Wheel;
+
+// Milliseconds since some fixed point, ticks of the wheels in the tables are milliseconds.
+static inline uint64_t monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline void initWheel(Wheel* wheel, uint64_t now) {
+    for (int i = 0; i < WHEEL_LEVELS; i++)
+        for (int j = 0; j < WHEEL_SLOTS; j++)
+            wheel->slots[i][j] = NULL;
+    wheel->occupied = 0;
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+// A timer goes to the lowest level whose span reaches its expiry. Timers beyond the span of
+// the whole wheel wait in the farthest slot and are placed again when it comes round.
+static inline void addTimer(Wheel* wheel, Timer* timer) {
+    uint64_t expires = (timer->expires < wheel->now) ? wheel->now : timer->expires;
+    uint64_t delta = expires - wheel->now;
+    if (delta >> (WHEEL_BITS * WHEEL_LEVELS))
+        expires = wheel->now + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)))
+        level++;
+    size_t index = (expires >> (WHEEL_BITS * level)) % WHEEL_SLOTS;
+    Timer** slot = &wheel->slots[level][index];
+    if (!level)
+        wheel->occupied |= (uint64_t)1 << index;
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->link = &timer->next;
+    timer->link = slot;
+    *slot = timer;
+    wheel->count++;
+}
+
+static inline void removeTimer(Wheel* wheel, Timer* timer) {
+    *timer->link = timer->next;
+    if (timer->next)
+        timer->next->link = timer->link;
+    timer->link = NULL;
+    wheel->count--;
+}
+
+// Called when wheel->now has just moved on, redistributes the slots of the levels that
+// wrapped around at this tick.
+static inline void cascadeWheel(Wheel* wheel) {
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (wheel->now & (((uint64_t)1 << (WHEEL_BITS * level)) - 1))
+            return;
+        Timer** slot = &wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) % WHEEL_SLOTS];
+        Timer* timer = *slot;
+        *slot = NULL;
+        while (timer) {
+            Timer* next = timer->next;
+            wheel->count--;
+            addTimer(wheel, timer);
+            timer = next;
+        }
+    }
+}
+
+// Takes out and returns one timer that expires at now or earlier, NULL once there is
+// none left. The caller decides how many to handle per call, the rest wait for the next.
+// Ticks up to the next occupied level 0 slot or the next wrap are skipped in one go.
+static inline Timer* nextExpired(Wheel* wheel, uint64_t now) {
+    while (1) {
+        size_t index = wheel->now % WHEEL_SLOTS;
+        Timer* timer = wheel->slots[0][index];
+        if (timer) {
+            removeTimer(wheel, timer);
+            return timer;
+        }
+        wheel->occupied &= ~((uint64_t)1 << index);
+        if (wheel->now >= now)
+            return NULL;
+        if (!wheel->count) {
+            wheel->now = now;
+            return NULL;
+        }
+        uint64_t ahead = wheel->occupied >> index;
+        uint64_t next = ahead ? wheel->now + __builtin_ctzll(ahead) : (wheel->now | (WHEEL_SLOTS - 1)) + 1;
+        wheel->now = (next < now) ? next : now;
+        cascadeWheel(wheel);
+    }
+}
+
+#endif